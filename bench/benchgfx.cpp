@@ -0,0 +1,257 @@
+#include "fx.h"
+#include "warp.h"
+#include "color.h"
+#include "cpu.h"
+#include "effectcache.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QImage>
+#include <QColor>
+#include <QTransform>
+#include <QThread>
+#include <QFile>
+#include <QVector>
+#include <QHash>
+#include <functional>
+#include <cstdio>
+
+/*
+// docsurf-bench-gfx ===============================================
+*  Runs the FX kernels over synthetic images and prints throughput
+*  as JSON. CPU::level() is settled once per process, so every
+*  instruction set is measured in a child of its own started with
+*  DOCSURF_SIMD set, the parent only merges their results and adds
+*  the speedup over the scalar run.
+*/
+
+static const char *levelName(const CPU::Level level)
+{
+    switch (level)
+    {
+    case CPU::AVX2: return "avx2";
+    case CPU::SSE2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+/* noise over a diagonal gradient, the same for every run */
+static QImage
+synthetic(const int size, const QImage::Format format)
+{
+    QImage img(size, size, QImage::Format_ARGB32);
+    quint32 seed(0x9e3779b9);
+    for (int y = 0; y < size; ++y)
+    {
+        QRgb *px = reinterpret_cast<QRgb *>(img.scanLine(y));
+        for (int x = 0; x < size; ++x)
+        {
+            seed = seed*1664525u + 1013904223u;
+            const int base = (x+y)*255/qMax(1, 2*size-2);
+            const int n = int(seed >> 24) - 128;
+            px[x] = qRgba(qBound(0, base+n/2, 255), qBound(0, 255-base+n/4, 255), qBound(0, base/2+n/3, 255), qBound(0, 160+n, 255));
+        }
+    }
+    return format == QImage::Format_ARGB32 ? img : img.convertToFormat(format);
+}
+
+/* Calls prepare untimed and work timed until minMs of work has been
+ * measured, at least three times, and returns the mean nanoseconds
+ * per call.
+ */
+static double
+measure(const std::function<void ()> &prepare, const std::function<void ()> &work, const int minMs)
+{
+    QElapsedTimer timer;
+    qint64 spent(0);
+    int runs(0);
+    while (runs < 3 || spent < qint64(minMs)*1000000)
+    {
+        prepare();
+        timer.start();
+        work();
+        spent += timer.nsecsElapsed();
+        ++runs;
+    }
+    return double(spent)/runs;
+}
+
+static QJsonObject
+result(const QString &kernel, const QString &format, const int size, const qint64 items, const QString &unit, const double ns)
+{
+    QJsonObject o;
+    o["kernel"] = kernel;
+    o["format"] = format;
+    o["size"] = size;
+    o["level"] = levelName(CPU::level());
+    o["unit"] = unit;
+    o["msPerCall"] = ns/1e6;
+    o["megaPerSecond"] = double(items)*1e3/ns;
+    return o;
+}
+
+static QJsonArray
+runKernels(const QList<int> &sizes, const int minMs)
+{
+    //every call has to do the work, not find it done already
+    EffectCache::setBudget(0);
+
+    struct Format { QImage::Format format; const char *name; };
+    static const Format formats[] = {
+        { QImage::Format_ARGB32, "argb32" },
+        { QImage::Format_ARGB32_Premultiplied, "argb32pm" }
+    };
+
+    QJsonArray results;
+    for (int s = 0; s < sizes.count(); ++s)
+    {
+        const int size = sizes.at(s);
+        const qint64 pixels = qint64(size)*size;
+        for (unsigned int f = 0; f < sizeof(formats)/sizeof(formats[0]); ++f)
+        {
+            const QString format = formats[f].name;
+            const QImage source = synthetic(size, formats[f].format);
+            const QImage other = synthetic(size, formats[f].format).mirrored(true, false);
+            QImage img;
+            const std::function<void ()> fresh = [&]() { img = source.copy(); };
+            const std::function<void ()> none = []() {};
+
+            results << result("expblur", format, size, pixels, "MP", measure(fresh, [&]() { FX::expblur(img, 8); }, minMs));
+            //large radii like the ones FX::stretched asks for, where FX::blur picks the box engine
+            results << result("expblur-r64", format, size, pixels, "MP", measure(fresh, [&]() { FX::expblur(img, 64); }, minMs));
+            results << result("boxblur-r64", format, size, pixels, "MP", measure(fresh, [&]() { FX::boxblur(img, 64); }, minMs));
+            results << result("mid", format, size, pixels, "MP", measure(none, [&]() { img = FX::mid(source, other, 1, 2); }, minMs));
+            results << result("stretched", format, size, pixels, "MP", measure(none, [&]() { img = FX::stretched(source, QColor(64, 128, 192)); }, minMs));
+            results << result("autoStretch", format, size, pixels, "MP", measure(fresh, [&]() { FX::autoStretch(img); }, minMs));
+            if (formats[f].format == QImage::Format_ARGB32_Premultiplied)
+            {
+                //a cover of the flow turned away, about what it draws in software
+                QTransform cover;
+                cover.translate(size/2, size/2).rotate(50.0, Qt::YAxis).translate(-size/2, -size/2);
+                const QImage background = synthetic(size, formats[f].format);
+                const std::function<void ()> clean = [&]() { img = background.copy(); };
+                results << result("warp", format, size, pixels, "MP", measure(clean, [&]() { FX::warp(img, source, cover); }, minMs));
+            }
+        }
+    }
+
+    const int pairs = 4096;
+    QVector<QColor> colors(pairs*2);
+    quint32 seed(0x2545f491);
+    for (int i = 0; i < colors.count(); ++i)
+    {
+        seed = seed*1664525u + 1013904223u;
+        colors[i] = QColor::fromRgb(seed >> 8);
+    }
+    QVector<QColor> work;
+    results << result("ensureContrast", "qcolor", pairs, pairs, "Mpairs",
+                      measure([&]() { work = colors; },
+                              [&]() { for (int i = 0; i < pairs; ++i) Color::ensureContrast(work[i*2], work[i*2+1]); },
+                              minMs));
+    return results;
+}
+
+static QString
+key(const QJsonObject &o)
+{
+    return QString("%1 %2 %3").arg(o["kernel"].toString(), o["format"].toString()).arg(o["size"].toInt());
+}
+
+int
+main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("docsurf-bench-gfx");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Throughput of the DocSurf gfx kernels, as JSON on stdout.");
+    parser.addHelpOption();
+    const QCommandLineOption sizesOption("sizes", "Comma separated square image sizes.", "list", "64,256,1024,2048");
+    const QCommandLineOption timeOption("min-time", "Milliseconds to measure each case for at least.", "ms", "200");
+    const QCommandLineOption outputOption("output", "Write the JSON to file instead of stdout.", "file");
+    const QCommandLineOption childOption("child", "Measure the current instruction set only.");
+    parser.addOption(sizesOption);
+    parser.addOption(timeOption);
+    parser.addOption(outputOption);
+    parser.addOption(childOption);
+    parser.process(app);
+
+    QList<int> sizes;
+    const QStringList &list = parser.value(sizesOption).split(',', QString::SkipEmptyParts);
+    for (int i = 0; i < list.count(); ++i)
+        if (list.at(i).toInt() > 0)
+            sizes << list.at(i).toInt();
+    const int minMs = qMax(1, parser.value(timeOption).toInt());
+
+    if (parser.isSet(childOption))
+    {
+        const QByteArray &json = QJsonDocument(runKernels(sizes, minMs)).toJson(QJsonDocument::Compact);
+        fwrite(json.constData(), 1, json.size(), stdout);
+        return 0;
+    }
+
+    //the parent must see what the cpu can do, not what it was told
+    qunsetenv("DOCSURF_SIMD");
+    const int best = CPU::level();
+
+    QJsonArray results;
+    QHash<QString, double> scalar;
+    for (int level = CPU::Scalar; level <= best; ++level)
+    {
+        const char *name = levelName(CPU::Level(level));
+        fprintf(stderr, "measuring %s...\n", name);
+        QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+        env.insert("DOCSURF_SIMD", name);
+        QProcess child;
+        child.setProcessEnvironment(env);
+        child.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        child.start(app.applicationFilePath(), QStringList() << "--child"
+                    << "--sizes" << parser.value(sizesOption)
+                    << "--min-time" << QString::number(minMs));
+        if (!child.waitForFinished(-1) || child.exitCode())
+        {
+            fprintf(stderr, "%s run failed\n", name);
+            return 1;
+        }
+        const QJsonArray &runs = QJsonDocument::fromJson(child.readAllStandardOutput()).array();
+        for (int i = 0; i < runs.count(); ++i)
+        {
+            QJsonObject o = runs.at(i).toObject();
+            const double rate = o["megaPerSecond"].toDouble();
+            if (level == CPU::Scalar)
+                scalar.insert(key(o), rate);
+            if (scalar.value(key(o)) > 0.0)
+                o["speedup"] = rate/scalar.value(key(o));
+            fprintf(stderr, "  %-16s %-9s %5d %10.1f %s/s\n", qPrintable(o["kernel"].toString()),
+                    qPrintable(o["format"].toString()), o["size"].toInt(), rate, qPrintable(o["unit"].toString()));
+            results << o;
+        }
+    }
+
+    QJsonObject report;
+    report["benchmark"] = app.applicationName();
+    report["bestLevel"] = levelName(CPU::Level(best));
+    report["threads"] = QThread::idealThreadCount();
+    report["minTimeMs"] = minMs;
+    report["results"] = results;
+    const QByteArray &json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly))
+        {
+            fprintf(stderr, "cannot write %s\n", qPrintable(parser.value(outputOption)));
+            return 1;
+        }
+        file.write(json);
+        return 0;
+    }
+    fwrite(json.constData(), 1, json.size(), stdout);
+    return 0;
+}
@@ -20,7 +20,10 @@
 
 
 #include "application.h"
+#include "gfx/effectcache.h"
+#include "iconprovider.h"
 #include <QDebug>
+#include <QEvent>
 #include <QLocalServer>
 #include <QLocalSocket>
 
@@ -51,3 +54,20 @@ Application::Application(int &argc, char *argv[]) : QApplication(argc, argv)
     }
 }
 
+Application::~Application()
+{
+    //cached pixmaps would otherwise go with the statics, after us
+    EffectCache::clear();
+}
+
+bool
+Application::event(QEvent *e)
+{
+    //effects baked with the old colors are of no use anymore
+    if (e->type() == QEvent::ApplicationPaletteChange || e->type() == QEvent::ThemeChange)
+        EffectCache::clear();
+    //the icon theme may have changed with it
+    if (e->type() == QEvent::ThemeChange)
+        DocSurf::IconCache::instance()->clear();
+    return QApplication::event(e);
+}
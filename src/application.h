@@ -34,9 +34,13 @@ class Application : public QApplication
     Q_OBJECT
 public:
     Application(int &argc, char *argv[]);
+    ~Application();
     inline bool isRunning() { return m_isRunning; }
     void emitSettingsChanged() { emit settingsChanged(); }
 
+protected:
+    bool event(QEvent *e);
+
 signals:
     void settingsChanged();
 
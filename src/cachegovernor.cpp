@@ -0,0 +1,210 @@
+/**************************************************************************
+*   Copyright (C) 2013 by Robert Metsaranta                               *
+*   therealestrob@gmail.com                                               *
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program; if not, write to the                         *
+*   Free Software Foundation, Inc.,                                       *
+*   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+***************************************************************************/
+
+
+#include <QTimer>
+#include <QFile>
+#include <QApplication>
+
+#include <KSharedConfig>
+#include <KConfigGroup>
+
+#include <unistd.h>
+
+#include "cachegovernor.h"
+#include "gfx/effectcache.h"
+
+using namespace DocSurf;
+
+//function static, caches live in static storage too and may
+//register before anything in this file is initialized
+QList<Cacheable *>
+&Cacheable::registry()
+{
+    static QList<Cacheable *> s_cacheables;
+    return s_cacheables;
+}
+
+Cacheable::Cacheable(const Priority priority)
+    : m_priority(priority)
+{
+    registry() << this;
+}
+
+Cacheable::~Cacheable()
+{
+    registry().removeOne(this);
+}
+
+QList<Cacheable *>
+Cacheable::cacheables()
+{
+    return registry();
+}
+
+/* gfx is also built without the application around it, so the
+ * effect cache is registered and given its budget, "EffectCacheBudget"
+ * in MiB, from here
+ */
+class EffectCacheBudget : public Cacheable, public Configurable
+{
+public:
+    EffectCacheBudget() : Cacheable(Disposable), Configurable() { reconfigure(); }
+    QString cacheName() const { return "effects"; }
+    qint64 cacheCost() const { return EffectCache::cost(); }
+    void shrinkCache(const qint64 bytes) { EffectCache::shrink(bytes); }
+    void reconfigure()
+    {
+        KConfigGroup config = KSharedConfig::openConfig("NSEDocSurf.conf")->group("Views");
+        EffectCache::setBudget(qBound(0, config.readEntry("EffectCacheBudget", 8), 1024)*1024*1024);
+    }
+};
+
+CacheGovernor *CacheGovernor::s_instance = 0;
+
+CacheGovernor
+*CacheGovernor::instance()
+{
+    if (!s_instance)
+        s_instance = new CacheGovernor(qApp);
+    return s_instance;
+}
+
+CacheGovernor::CacheGovernor(QObject *parent)
+    : QObject(parent)
+    , Configurable()
+    , m_timer(new QTimer(this))
+    , m_budget(0)
+    , m_shrinks(0)
+    , m_cooldown(0)
+{
+    connect(m_timer, &QTimer::timeout, this, &CacheGovernor::govern);
+    m_timer->start(Interval);
+    reconfigure();
+    //once, along with the governor
+    static EffectCacheBudget s_effectCache;
+    Q_UNUSED(s_effectCache);
+}
+
+void
+CacheGovernor::reconfigure()
+{
+    KConfigGroup config = KSharedConfig::openConfig("NSEDocSurf.conf")->group("Views");
+    m_budget = qint64(config.readEntry("CacheBudget", 512))*1024*1024;
+}
+
+qint64
+CacheGovernor::residentBytes()
+{
+    //statm: size resident shared text lib data dt, in pages
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0;
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.count() < 2)
+        return 0;
+    return fields.at(1).toLongLong()*sysconf(_SC_PAGESIZE);
+}
+
+qreal
+CacheGovernor::memoryPressure()
+{
+    //"some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+    QFile psi("/proc/pressure/memory");
+    if (!psi.open(QIODevice::ReadOnly))
+        return 0.0f;
+    const QByteArray &some = psi.readLine();
+    const int start = some.indexOf("avg10=");
+    if (start == -1)
+        return 0.0f;
+    const int end = some.indexOf(' ', start);
+    return some.mid(start+6, end-start-6).toDouble();
+}
+
+void
+CacheGovernor::govern()
+{
+    //what was just dropped is being painted and requested again, give it time
+    if (m_cooldown > 0)
+    {
+        --m_cooldown;
+        return;
+    }
+    //what can not be given back would only have the others dropped for it
+    const QList<Cacheable *> all = Cacheable::cacheables();
+    QList<Cacheable *> caches;
+    qint64 cached(0);
+    for (int i = 0; i < all.count(); ++i)
+    {
+        Cacheable *c = all.at(i);
+        if (!c->isShrinkable())
+            continue;
+        caches << c;
+        cached += c->cacheCost();
+    }
+
+    qint64 excess(0);
+    int top(Cacheable::Precious);
+    if (cached > m_budget)
+        excess = cached - m_budget*LowWater/100;
+    else if (memoryPressure() > PressureLimit)
+    {
+        //the system is stalling on memory, the cheap ones give back half of what they hold
+        excess = cached/2;
+        top = Cacheable::Rebuildable;
+    }
+    if (excess <= 0)
+        return;
+
+    ++m_shrinks;
+    m_cooldown = Cooldown;
+    for (int p = Cacheable::Disposable; p <= top && excess > 0; ++p)
+        for (int i = 0; i < caches.count() && excess > 0; ++i)
+        {
+            Cacheable *c = caches.at(i);
+            if (c->cachePriority() != p)
+                continue;
+            const qint64 before = c->cacheCost();
+            c->shrinkCache(excess);
+            excess -= before - c->cacheCost();
+        }
+}
+
+QString
+CacheGovernor::statistics() const
+{
+    const QList<Cacheable *> caches = Cacheable::cacheables();
+    qint64 cached(0), fixed(0);
+    for (int i = 0; i < caches.count(); ++i)
+        (caches.at(i)->isShrinkable() ? cached : fixed) += caches.at(i)->cacheCost();
+    QString stats = QString("rss %1 KiB cached %2 KiB (+%6 KiB not shrinkable) budget %3 KiB pressure %4 shrinks %5\n")
+            .arg(residentBytes()/1024)
+            .arg(cached/1024)
+            .arg(m_budget/1024)
+            .arg(memoryPressure(), 0, 'f', 2)
+            .arg(m_shrinks)
+            .arg(fixed/1024);
+    for (int i = 0; i < caches.count(); ++i)
+        stats += QString("%1 priority %2 %3 KiB\n")
+                .arg(caches.at(i)->cacheName())
+                .arg(caches.at(i)->cachePriority())
+                .arg(caches.at(i)->cacheCost()/1024);
+    return stats;
+}
@@ -0,0 +1,99 @@
+/**************************************************************************
+*   Copyright (C) 2013 by Robert Metsaranta                               *
+*   therealestrob@gmail.com                                               *
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program; if not, write to the                         *
+*   Free Software Foundation, Inc.,                                       *
+*   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+***************************************************************************/
+
+
+#ifndef CACHEGOVERNOR_H
+#define CACHEGOVERNOR_H
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include "widgets.h"
+
+class QTimer;
+namespace DocSurf
+{
+
+/* Anything holding memory that can be rebuilt on demand.
+ * Cacheables register themselves the same way Configurables
+ * do, the governor shrinks them lowest priority first.
+ */
+class Cacheable
+{
+public:
+    enum Priority { Disposable = 0, Rebuildable, Expensive, Precious };
+    explicit Cacheable(const Priority priority);
+    ~Cacheable();
+    virtual QString cacheName() const = 0;
+    virtual qint64 cacheCost() const = 0;
+    /* release about bytes, releasing more is fine,
+     * anything that can not be released is kept.
+     */
+    virtual void shrinkCache(const qint64 bytes) = 0;
+    /* false for what only reports its cost, it is left out of
+     * the governed total and never asked to shrink
+     */
+    virtual bool isShrinkable() const { return true; }
+    inline Priority cachePriority() const { return m_priority; }
+    static QList<Cacheable *> cacheables();
+
+private:
+    static QList<Cacheable *> &registry();
+    Priority m_priority;
+};
+
+/* Keeps what the registered caches report within a budget,
+ * configured as "CacheBudget" in MiB. Once their total goes over
+ * it they are shrunk down to LowWater percent of it, and left
+ * alone for Cooldown ticks after. When the system wide memory
+ * pressure (PSI) is high the cheap to rebuild ones give back half
+ * of what they hold, expensive ones only ever for the budget.
+ * Process RSS is reported only, freed cache memory mostly stays
+ * with malloc or the X server and would never bring it down, the
+ * same goes for caches that can not shrink.
+ */
+class CacheGovernor : public QObject, public Configurable
+{
+    Q_OBJECT
+public:
+    enum { Interval = 5000, PressureLimit = 10 /*% of time stalled*/, LowWater = 75 /*% of budget*/, Cooldown = 3 /*ticks*/ };
+    static CacheGovernor *instance();
+    void reconfigure();
+    static qint64 residentBytes();
+    static qreal memoryPressure();
+    QString statistics() const;
+
+public slots:
+    void govern();
+
+protected:
+    explicit CacheGovernor(QObject *parent = 0);
+
+private:
+    static CacheGovernor *s_instance;
+    QTimer *m_timer;
+    qint64 m_budget;
+    int m_shrinks;
+    int m_cooldown;
+};
+
+}
+
+#endif // CACHEGOVERNOR_H
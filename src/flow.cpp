@@ -30,7 +30,6 @@
 #include <QTransform>
 #include <QRegion>
 #include <QGraphicsSimpleTextItem>
-#include <QGraphicsItemAnimation>
 #include <QGraphicsDropShadowEffect>
 #include <QGraphicsProxyWidget>
 #include <QGraphicsEffect>
@@ -38,19 +37,28 @@
 #include <QHash>
 #include <QMouseEvent>
 #include <QGLWidget>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOffscreenSurface>
 #include <QList>
-#include <QTimeLine>
+#include <QTimer>
 #include <QDebug>
 #include <QScrollBar>
 #include <QGraphicsScene>
 #include <QGraphicsView>
 #include <QQueue>
+#include <QSet>
+
+#include <algorithm>
+#include <string.h>
 
 #include <KFileItem>
 
 #include "gfx/color.h"
+#include "gfx/warp.h"
 #include "flow.h"
 #include "fsmodel.h"
+#include "imagepreparer.h"
 
 using namespace DocSurf;
 
@@ -63,6 +71,10 @@ using namespace DocSurf;
 #define RECT QRectF(0.0f, 0.0f, SIZE, SIZE)
 
 static float space = 48.0f, bMargin = 8;
+static const float omega = 12.0f; //spring frequency of the center in 1/s, critically damped
+static const float lookAhead = 0.75f; //seconds of motion to have covers prefetched for
+static const int maxPrefetch = 96;
+static const float flingSpeed = 24.0f; //rows/s above which only the destination is prefetched
 
 class ScrollBar : public QScrollBar
 {
@@ -126,6 +138,37 @@ protected:
     }
 };
 
+/* true when the only gl we would get is a software rasterizer,
+ * DOCSURF_FLOW_RENDERER=cpu or =gl overrides the guess.
+ */
+static bool
+softwareGL()
+{
+    static int software(-1);
+    if (software != -1)
+        return software;
+    const QByteArray forced = qgetenv("DOCSURF_FLOW_RENDERER");
+    if (forced == "cpu" || forced == "gl")
+        return software = forced == "cpu";
+
+    software = 1;
+    if (!QGLFormat::hasOpenGL())
+        return software;
+    QOffscreenSurface surface;
+    surface.create();
+    QOpenGLContext context;
+    if (context.create() && context.makeCurrent(&surface))
+    {
+        const QByteArray renderer = QByteArray(reinterpret_cast<const char *>(context.functions()->glGetString(GL_RENDERER))).toLower();
+        software = renderer.isEmpty()
+                || renderer.contains("llvmpipe")
+                || renderer.contains("softpipe")
+                || renderer.contains("swrast");
+        context.doneCurrent();
+    }
+    return software;
+}
+
 class GraphicsScene : public QGraphicsScene
 {
 public:
@@ -154,25 +197,27 @@ class Flow::Item : public QGraphicsItem
     friend class Flow;
 public:
     QPixmap pix[2];
+    QImage img[2]; //what the cpu renderer warps, only kept when it is in use
     GraphicsScene *scene;
     Flow *preView;
-    float rotate, savedX;
+    float rotate, scaleFactor;
     bool dirty;
+    int row;
+    QPersistentModelIndex persistentIndex; //follows the row through inserts, removals and sorting
     QPainterPath path;
     Item(GraphicsScene *scene, QGraphicsItem *parent)
         : QGraphicsItem(parent)
         , scene(scene)
+        , rotate(0.0f)
+        , scaleFactor(1.0f)
         , dirty(true)
+        , row(-1)
     {
         this->preView = scene->preView;
         setY(preView->y());
         setTransformOriginPoint(boundingRect().center());
     }
-    ~Item()
-    {
-        if (preView->items().contains(this))
-            preView->items().removeOne(this);
-    }
+    ~Item() {}
     void transform(const float angle, const Qt::Axis axis, const float xscale = 1.0f, const float yscale = 1.0f)
     {
         QTransform t;
@@ -184,36 +229,47 @@ public:
         t.translate(-SIZE/2.0f, -SIZE/2.0f);
         setTransform(t);
         rotate = angle;
+        scaleFactor = yscale;
     }
-    QRectF boundingRect() const { return RECT; }
-    void saveX() { savedX = pos().x(); }
+    enum { Type = UserType + 1 };
+    int type() const { return Type; }
+    QRectF boundingRect() const { return QRectF(0.0f, 0.0f, SIZE, SIZE*2.0f); } //with the reflection
     QPainterPath shape() const { return path; }
-    QModelIndex index() { return preView->indexOfItem(this); }
+    QModelIndex index() const { return persistentIndex; }
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
     {
         if (dirty)
             updateIcon();
+        if (preView->softwareRendering()) //drawn by the flow itself
+            return;
         if (painter->transform().isScaling())
             painter->setRenderHints(QPainter::SmoothPixmapTransform);
     //    painter->drawTiledPixmap(QRect(0, SIZE, SIZE, SIZE), m_pix[1]);
 
-        const QRect rect(1,1,256,256);
-        const QRect &pixRect = QApplication::style()->itemPixmapRect(rect, Qt::AlignBottom|Qt::AlignHCenter, pix[0]);
-        painter->drawPixmap(pixRect, pix[0]);
-        const QRect &refRect = QApplication::style()->itemPixmapRect(rect.translated(0, 258), Qt::AlignTop|Qt::AlignHCenter, pix[0]);
-        painter->drawPixmap(refRect, pix[1]);
+        painter->drawPixmap(pixRect(), pix[0]);
+        if (!pix[1].isNull())
+            painter->drawPixmap(refRect(), pix[1]);
         painter->setRenderHints(QPainter::SmoothPixmapTransform, false);
     }
+    QRect pixRect() const { return QApplication::style()->itemPixmapRect(QRect(1,1,256,256), Qt::AlignBottom|Qt::AlignHCenter, pix[0]); }
+    QRect refRect() const { return QApplication::style()->itemPixmapRect(QRect(1,259,256,256), Qt::AlignTop|Qt::AlignHCenter, pix[0]); }
     void updateIcon()
     {
-        pix[0] = index().data(Qt::DecorationRole).value<QIcon>().pixmap(QSize(256, 256));
-        pix[1] = pix[0].transformed(QTransform().scale(1, -1));
-        QPainter p(&pix[1]);
+        const QModelIndex idx(index());
+        const FS::ProxyModel *model = qobject_cast<const FS::ProxyModel *>(idx.model());
+        const FS::Thumbnail thumb = model ? model->thumbnail(idx, FS::Thumbnail::MaxExtent) : FS::Thumbnail();
+        if (!thumb.isNull())
+            pix[0] = thumb.pixmap(FS::Thumbnail::MaxExtent);
+        else
+            pix[0] = idx.data(Qt::DecorationRole).value<QIcon>().pixmap(QSize(256, 256));
         static QColor bg = preView->bg();
         if (bg.alpha() == 0xff)
             bg.setAlpha(222);
-        p.fillRect(pix[1].rect(), bg);
-        p.end();
+        //the flipped and tinted reflection is made on a worker thread and
+        //shared by every flow, we get marked dirty again once it is ready
+        pix[1] = ImagePreparer::instance()->reflection(model ? model->urlForIndex(idx) : QUrl(), pix[0], bg);
+        for (int i = 0; i < 2; ++i)
+            img[i] = preView->softwareRendering() && !pix[i].isNull() ? pix[i].toImage().convertToFormat(QImage::Format_ARGB32_Premultiplied) : QImage();
         updateShape();
         dirty = false;
     }
@@ -222,10 +278,8 @@ public:
         if (pix[0].isNull())
             return;
 
-        const QRect rect(1,1,256,256);
-        const QRect &pixRect = QApplication::style()->itemPixmapRect(rect, Qt::AlignBottom|Qt::AlignHCenter, pix[0]);
         QPainterPath p;
-        p.addRegion(pixRect);
+        p.addRegion(pixRect());
         path = p;
     }
 };
@@ -238,19 +292,24 @@ public:
         , scene(new GraphicsScene(q->rect(), q))
         , model(0)
         , row(-1)
-        , nextRow(-1)
-        , newRow(-1)
+        , count(0)
+        , first(0)
         , savedRow(-1)
         , pressed(0)
         , y(0.0f)
         , x(0.0f)
-        , timeLine(new QTimeLine(250, q))
+        , pos(0.0f)
+        , target(0.0f)
+        , velocity(0.0f)
+        , wheelRest(0.0f)
+        , clock(new QTimer(q))
+        , populateTimer(new QTimer(q))
         , scrollBar(0)
         , rootItem(new Flow::RootItem(scene))
         , wantsDrag(false)
+        , software(false)
+        , userMoved(false)
         , perception(0.0f)
-        , hasZUpdate(false)
-        , xpos(0.0f)
     {}
     Flow * const q;
     QColor bg;
@@ -258,13 +317,15 @@ public:
     FS::ProxyModel *model;
     QModelIndex centerIndex, prevCenter, savedCenter;
     QPersistentModelIndex rootIndex;
-    int row, nextRow, newRow, savedRow, sortColumn;
+    int row, count, first, savedRow, sortColumn;
     Qt::SortOrder sortOrder;
-    float y, x, perception, xpos;
-    bool wantsDrag, hasZUpdate;
-    QList<Flow::Item *> items;
-    QGraphicsItemAnimation *anim[2];
-    QTimeLine *timeLine;
+    float y, x, perception;
+    float pos, target, velocity, wheelRest; //fractional center row, where it is heading and how fast in rows/s
+    bool wantsDrag, software, userMoved; //userMoved: the center is someone's choice, not just the first row
+    QImage backingStore; //the covers, when drawn on the cpu
+    QList<Flow::Item *> items, pool; //items is the window of rows first...first+items.count()-1
+    QTimer *clock, *populateTimer;
+    QElapsedTimer elapsed, dragClock;
     QGraphicsItem *pressed;
     QGraphicsSimpleTextItem *textItem;
     Flow::RootItem *rootItem;
@@ -273,47 +334,269 @@ public:
     QPointF pressPos;
     QItemSelectionModel *selectionModel;
     QUrl rootUrl, centerUrl;
-    bool isValidRow(const int row) { return bool(row > -1 && row < items.count()); }
-    int validate(const int row) const { return qBound(0, row, items.count()-1); }
+    QSet<QPersistentModelIndex> prefetched; //rows outside the window whose thumbnails may still be queued
+    bool isValidRow(const int row) { return bool(row > -1 && row < count); }
+    int validate(const int row) const { return qBound(0, row, count-1); }
+    int last() const { return first+items.count()-1; }
+    Flow::Item *item(const int row) const { return row >= first && row <= last() ? items.at(row-first) : 0; }
+    int span() const
+    {
+        //covers needed on either side of the center to fill the view
+        const float scale = qMax(0.1f, (float)rootItem->scale());
+        return qCeil(q->width()/(2.0f*space*scale)) + 2;
+    }
+    Flow::Item *acquire()
+    {
+        Flow::Item *item = pool.isEmpty() ? new Flow::Item(scene, rootItem) : pool.takeLast();
+        item->dirty = true;
+        item->show();
+        return item;
+    }
+    void release(Flow::Item *item)
+    {
+        //a cover leaving the window may still have its thumbnail queued
+        if (item->persistentIndex.isValid())
+            prefetched.insert(item->persistentIndex);
+        item->row = -1;
+        item->persistentIndex = QModelIndex();
+        item->hide();
+        item->pix[0] = item->pix[1] = QPixmap();
+        item->img[0] = item->img[1] = QImage();
+        item->dirty = true;
+        if (pool.count() < span()*2)
+            pool << item;
+        else
+            delete item;
+    }
+    void releaseAll()
+    {
+        while (!items.isEmpty())
+            release(items.takeLast());
+        first = 0;
+    }
+    /* only the rows around the center are real scene items,
+     * the window slides along with the center and items that
+     * fall out of it are recycled for the rows coming in.
+     * items keep their row so the ones still in the window
+     * stay as they are, whatever happened to the rows.
+     */
+    void syncWindow()
+    {
+        if (!count || row == -1)
+        {
+            releaseAll();
+            return;
+        }
+        const int s = span(), center = validate(row);
+        const int newFirst = qMax(0, center-s), newLast = qMin(count-1, center+s);
+        QHash<int, Flow::Item *> byRow;
+        for (int i = 0; i < items.count(); ++i)
+        {
+            Flow::Item *item = items.at(i);
+            if (item->row >= newFirst && item->row <= newLast && !byRow.contains(item->row))
+                byRow.insert(item->row, item);
+            else
+                release(item);
+        }
+        items.clear();
+        for (int r = newFirst; r <= newLast; ++r)
+        {
+            Flow::Item *item = byRow.value(r);
+            if (!item)
+            {
+                item = acquire();
+                item->row = r;
+                item->persistentIndex = model->index(r, 0, rootIndex);
+                //ask for the pixmaps as the cover comes into view, not when it first paints
+                item->updateIcon();
+            }
+            items << item;
+        }
+        first = newFirst;
+    }
+    /* rows moved under us, the persistent indexes know where to */
+    void remapRows()
+    {
+        for (int i = 0; i < items.count(); ++i)
+        {
+            Flow::Item *item = items.at(i);
+            item->row = item->persistentIndex.isValid() ? item->persistentIndex.row() : -1;
+        }
+    }
+    void markDirty(const int start, const int end)
+    {
+        for (int i = 0; i < items.count(); ++i)
+        {
+            Flow::Item *item = items.at(i);
+            if (item->row < start || item->row > end)
+                continue;
+            item->updateIcon();
+            item->update();
+        }
+    }
+    /* where a cover goes is a function of its distance to the
+     * fractional center alone, 0 is the center, 1 the first cover
+     * on the right, -1 the first on the left and so on. in between
+     * the center and the first side cover it turns and shrinks.
+     */
+    void place(Flow::Item *item, const float offset)
+    {
+        const float a = qAbs(offset), t = qMin(1.0f, a);
+        const bool right = offset > 0.0f;
+        const float center = x-SIZE/2.0f;
+        const float side = right ? x+space : (x-SIZE)-space;
+        float px = center + (side-center)*t;
+        if (a > 1.0f)
+            px += (right ? space : -space)*(a-1.0f);
+        const float angle = (right ? ANGLE : -ANGLE)*t;
+        const float scale = 1.0f + (SCALE-1.0f)*t;
+        item->setPos(px, y);
+        if (item->rotate != angle || item->scaleFactor != scale)
+            item->transform(angle, Qt::YAxis, scale, scale);
+        item->setZValue(-a);
+    }
+    /* only the covers in the window are touched, per frame */
+    void layout()
+    {
+        for (int i = 0; i < items.count(); ++i)
+            place(items.at(i), items.at(i)->row - pos);
+    }
+    float maxPos() const { return qMax(0, count-1); }
+    void moveCenter(const float p)
+    {
+        pos = qBound(0.0f, p, maxPos());
+        const int r = validate(qRound(pos));
+        if (r != row)
+        {
+            //crossed into the next row, the window follows
+            q->setCenterIndex(model->index(r, 0, rootIndex));
+            syncWindow();
+            prefetch();
+        }
+        layout();
+    }
+    /* covers about to slide into view get their thumbnails asked
+     * for now, around where the center is heading and ahead of the
+     * window, further ahead the faster the center moves. A fling
+     * passes most rows too quickly to show them, so then only the
+     * destination is asked for, and whatever was asked for earlier
+     * that is no longer near the window or the destination is
+     * taken out of the queue again.
+     */
+    void prefetch()
+    {
+        if (!count || row == -1 || !model)
+            return;
+        const int s = span();
+        const int t = validate(qRound(target));
+        if (t < first || t > last())
+            for (int r = qMax(0, t-s); r <= qMin(count-1, t+s); ++r)
+                requestThumbnail(r);
+
+        const float heading = target != pos ? target-pos : velocity;
+        const bool fling = qAbs(velocity) > flingSpeed;
+        const int ahead = fling ? 0 : qMin(maxPrefetch, s+qCeil(qAbs(velocity)*lookAhead));
+        for (int i = 1; i <= ahead; ++i)
+        {
+            if (heading >= 0.0f)
+                requestThumbnail(last()+i);
+            if (heading <= 0.0f)
+                requestThumbnail(first-i);
+        }
+        dropPrefetched(qMin(first, t-s)-ahead, qMax(last(), t+s)+ahead);
+    }
+    void requestThumbnail(const int r)
+    {
+        //rows in the window asked for theirs when they came in
+        if (!isValidRow(r) || item(r))
+            return;
+        const QModelIndex &index = model->index(r, 0, rootIndex);
+        prefetched.insert(index);
+        model->thumbnail(index, FS::Thumbnail::MaxExtent);
+    }
+    /* cancels what was prefetched for rows outside from...to */
+    void dropPrefetched(const int from, const int to)
+    {
+        QModelIndexList gone;
+        QSet<QPersistentModelIndex>::iterator it = prefetched.begin();
+        while (it != prefetched.end())
+        {
+            const int r = it->row();
+            if (it->isValid() && r >= from && r <= to)
+            {
+                ++it;
+                continue;
+            }
+            if (it->isValid())
+                gone << *it;
+            it = prefetched.erase(it);
+        }
+        if (!gone.isEmpty())
+            model->cancelThumbnails(gone);
+    }
+    /* new target, whatever velocity the center has is kept */
+    void retarget(const float t)
+    {
+        target = qBound(0.0f, t, maxPos());
+        userMoved = true;
+        prefetch();
+        if (clock->isActive() || (target == pos && velocity == 0.0f))
+            return;
+        elapsed.start();
+        clock->start();
+    }
+    /* rows arrive in chunks while a directory is listed, they are
+     * only counted here and laid out once per frame in flushRows
+     */
     void populate(const int start, const int end)
     {
-        for (int i = start; i <= end; i++)
-            items.insert(i, new Flow::Item(scene, rootItem));
-
-        QModelIndex index;
-        if (centerUrl.isValid())
-            index = model->indexForUrl(centerUrl);
-        if (!index.isValid())
-            index = model->index(validate(savedRow), 0, rootIndex);
-
-        q->setCenterIndex(index);
-        if (!items.isEmpty())
-            q->setCenterIndex(model->index(0, 0, rootIndex));
-        q->updateItemsPos();
-        q->update();
+        const int n = end-start+1;
+        count += n;
+        remapRows();
+        //rows landing before a chosen center push it along so the same cover stays in front
+        if (userMoved && row != -1 && start <= row)
+        {
+            row += n;
+            pos += n;
+            target += n;
+        }
+        if (!populateTimer->isActive())
+            populateTimer->start();
     }
 };
 
 Flow::Flow(QWidget *parent)
     : QGraphicsView(parent)
+    , Cacheable(Rebuildable)
     , d(new Private(this))
 {
-    QGLFormat glf = QGLFormat::defaultFormat();
-    glf.setSampleBuffers(false);
-    glf.setSwapInterval(0);
-    glf.setStencil(true);
-    glf.setAccum(true);
-    glf.setDirectRendering(true);
-    glf.setDoubleBuffer(true);
-    QGLFormat::setDefaultFormat(glf);
     setMaximumHeight(SIZE*2.0f);
-    QGLWidget *glWidget = new QGLWidget(glf, this);
-    connect(qApp, &QApplication::aboutToQuit, glWidget, &QGLWidget::deleteLater);
-    setViewport(glWidget);
-    setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
+    d->software = softwareGL();
+    if (d->software)
+    {
+        //software gl is slower than warping the few covers in view ourselves
+        setCacheMode(QGraphicsView::CacheNone);
+    }
+    else
+    {
+        QGLFormat glf = QGLFormat::defaultFormat();
+        glf.setSampleBuffers(false);
+        glf.setSwapInterval(0);
+        glf.setStencil(true);
+        glf.setAccum(true);
+        glf.setDirectRendering(true);
+        glf.setDoubleBuffer(true);
+        QGLFormat::setDefaultFormat(glf);
+        QGLWidget *glWidget = new QGLWidget(glf, this);
+        connect(qApp, &QApplication::aboutToQuit, glWidget, &QGLWidget::deleteLater);
+        setViewport(glWidget);
+        setCacheMode(QGraphicsView::CacheBackground);
+    }
+    //a gl viewport is double buffered and always repainted as a whole,
+    //anything else only needs the parts the moving covers touched
+    setViewportUpdateMode(qobject_cast<QGLWidget *>(viewport()) ? QGraphicsView::FullViewportUpdate : QGraphicsView::SmartViewportUpdate);
     setOptimizationFlag(QGraphicsView::DontSavePainterState);
     setOptimizationFlag(QGraphicsView::DontAdjustForAntialiasing);
-    setCacheMode(QGraphicsView::CacheBackground);
     d->scene->setItemIndexMethod(QGraphicsScene::NoIndex);
     setScene(d->scene);
     d->textItem = new QGraphicsSimpleTextItem();
@@ -326,15 +609,11 @@ Flow::Flow(QWidget *parent)
     connect(d->scrollBar, &QScrollBar::valueChanged, this, &Flow::scrollBarMoved);
     setFocusPolicy(Qt::NoFocus);
     setFrameStyle(QFrame::NoFrame);
-    for (int i = 0; i < 2; ++i)
-    {
-        d->anim[i] = new QGraphicsItemAnimation(this);
-        d->anim[i]->setTimeLine(d->timeLine);
-    }
-    d->timeLine->setEasingCurve(QEasingCurve::Linear);
-    d->timeLine->setUpdateInterval(17); //17 ~ 60 fps
-    connect(d->timeLine, &QTimeLine::valueChanged, this, &Flow::animStep);
-    connect(d->timeLine, &QTimeLine::finished, this, &Flow::continueIf);
+    d->clock->setInterval(17); //17 ~ 60 fps
+    connect(d->clock, &QTimer::timeout, this, &Flow::animStep);
+    d->populateTimer->setSingleShot(true);
+    d->populateTimer->setInterval(16);
+    connect(d->populateTimer, &QTimer::timeout, this, &Flow::flushRows);
 
     d->textItem = new QGraphicsSimpleTextItem();
     d->scene->addItem(d->textItem);
@@ -362,104 +641,84 @@ Flow::~Flow()
 //    m_dataLoader->discontinue();
 //    m_dataLoader->wait();
     qDeleteAll(d->items);
+    qDeleteAll(d->pool);
     d->items.clear();
+    d->pool.clear();
     delete d;
 }
 
-QModelIndex
-Flow::indexOfItem(Item *item) const
+QString
+Flow::cacheName() const
 {
-    if (d->items.contains(item))
-        return d->model->index(d->items.indexOf(item), 0, d->rootIndex);
-    return QModelIndex();
+    return "flow covers";
 }
 
-void
-Flow::showNext()
+qint64
+Flow::cacheCost() const
 {
-    d->nextRow = d->row+1;
-    prepareAnimation();
+    //pooled items hold no pixmaps
+    qint64 cost(0);
+    for (int i = 0; i < d->items.count(); ++i)
+        for (int p = 0; p < 2; ++p)
+        {
+            const QPixmap &pix = d->items.at(i)->pix[p];
+            cost += qint64(pix.width())*pix.height()*(pix.depth()/8);
+        }
+    return cost;
 }
 
 void
-Flow::showPrevious()
+Flow::shrinkCache(const qint64 bytes)
 {
-    d->nextRow = d->row-1;
-    prepareAnimation();
+    Q_UNUSED(bytes);
+    //the window only holds what is on screen, the pool can go
+    qDeleteAll(d->pool);
+    d->pool.clear();
 }
 
-void
-Flow::prepareAnimation()
+QModelIndex
+Flow::indexOfItem(Item *item) const
 {
-    if (!d->isValidRow(d->newRow))
-        return;
-
-    int i = d->items.count();
-    while (--i > -1)
-        d->items.at(i)->saveX();
-#define CENTER QPoint(d->x - SIZE / 2.0f, d->y)
-#define LEFT QPointF((d->x - SIZE) - space, d->y)
-#define RIGHT QPointF(d->x + space, d->y)
-    d->anim[New]->setItem(d->items.at(d->validate(d->nextRow)));
-    d->anim[New]->setPosAt(1, CENTER);
-    d->anim[Prev]->setItem(d->items.at(d->validate(d->row)));
-    d->anim[Prev]->setPosAt(1, d->nextRow > d->row ? LEFT : RIGHT);
-#undef CENTER
-#undef RIGHT
-#undef LEFT
-    d->hasZUpdate = false;
-    d->timeLine->setDuration(qMax(1.0f, 250.0f / qAbs(d->row - d->newRow)));
-    d->timeLine->start();
+    if (item && item->row != -1)
+        return item->persistentIndex;
+    return QModelIndex();
 }
 
 void
-Flow::animStep(const qreal value)
+Flow::animStep()
 {
-    if (d->items.isEmpty())
+    if (!d->count)
+    {
+        d->clock->stop();
         return;
+    }
 
-    const float f = SCALE+(value*(1.0f-SCALE)), s = space*value;
-    const bool goingUp = d->nextRow > d->row;
-
-    float rotate = ANGLE * value;
-    d->items.at(d->row)->transform(goingUp ? -rotate : rotate, Qt::YAxis, SCALE/f, SCALE/f);
-
-    rotate = ANGLE-rotate;
-    d->items.at(d->nextRow)->transform(goingUp ? rotate : -rotate, Qt::YAxis, f, f);
-
-#define UP d->items.at(i)->savedX-s
-#define DOWN d->items.at(i)->savedX+s
-
-    int i = d->items.count();
-    while (--i > -1)
+    //wall time, a late frame catches up instead of slowing the motion down,
+    //integrated in small steps so the spring stays stable
+    float dt = qMin<qint64>(50, d->elapsed.restart())/1000.0f;
+    float p = d->pos;
+    while (dt > 0.0f)
     {
-        if (i != d->row && i != d->nextRow)
-            d->items.at(i)->setX(goingUp ? UP : DOWN);
-        if (!d->hasZUpdate)
-            d->items.at(i)->setZValue(i>=d->nextRow ? d->items.at(qMin(d->items.count()-1, i+1))->zValue()+1 : d->items.at(qMax(0, i-1))->zValue()-1);
+        const float h = qMin(dt, 0.004f);
+        d->velocity += (omega*omega*(d->target-p) - 2.0f*omega*d->velocity)*h;
+        p += d->velocity*h;
+        dt -= h;
     }
-
-    d->hasZUpdate = true;
-
-    if (value == 1)
+    if (qAbs(d->target-p) < 0.001f && qAbs(d->velocity) < 0.01f)
     {
-        setCenterIndex(d->model->index(d->nextRow, 0, d->rootIndex));
-        if (d->newRow == d->row)
-        {
-            d->newRow = -1;
-            d->nextRow = -1;
-            emit centerIndexChanged(d->centerIndex);
-        }
+        p = d->target;
+        d->velocity = 0.0f;
+        d->clock->stop();
     }
-}
+    d->moveCenter(p);
 
-void
-Flow::continueIf()
-{
-    if (d->newRow > d->row)
-        showNext();
-    else if (d->newRow < d->row)
-        showPrevious();
+    if (!d->clock->isActive())
+    {
+        d->scrollBar->blockSignals(true);
+        d->scrollBar->setValue(d->row);
+        d->scrollBar->blockSignals(false);
+        emit centerIndexChanged(d->centerIndex);
+    }
 }
 
 void
@@ -477,8 +736,17 @@ Flow::wheelEvent(QWheelEvent *event)
     else if (event->modifiers() & Qt::MetaModifier)
         d->rootItem->setScale(d->rootItem->scale()+((float)event->angleDelta().y()*0.001f));
     else
-        d->scrollBar->setValue(d->scrollBar->value()+(event->angleDelta().y()>0?-1:1));
-//        QCoreApplication::sendEvent(d->scrollBar, event);
+    {
+        //notches stack up on the target, smooth wheels and touchpads
+        //send fractions of one that are collected until a row is due
+        d->wheelRest -= event->angleDelta().y()/120.0f;
+        const int steps = d->wheelRest > 0.0f ? qFloor(d->wheelRest) : qCeil(d->wheelRest);
+        if (steps)
+        {
+            d->wheelRest -= steps;
+            d->retarget(qRound(d->target)+steps);
+        }
+    }
 }
 
 void
@@ -502,15 +770,22 @@ Flow::setModel(FS::ProxyModel *model)
     connect(d->model, &QAbstractItemModel::rowsRemoved, this, &Flow::rowsRemoved);
     connect(d->model, &QAbstractItemModel::layoutChanged, this, [this]()
     {
-        if (d->sortColumn != d->model->sortColumn()
-                || d->sortOrder != d->model->sortOrder())
-        {
-            d->sortColumn = d->model->sortColumn();
-            d->sortOrder = d->model->sortOrder();
-//            reset();
-            for (int i = 0; i < d->items.count(); ++i)
-                d->items.at(i)->dirty = true;
-        }
+        //sorting or filtering, the items keep showing the same files, they
+        //just need to be put in their new places
+        d->sortColumn = d->model->sortColumn();
+        d->sortOrder = d->model->sortOrder();
+        d->count = d->model->rowCount(d->rootIndex);
+        d->remapRows();
+        const QModelIndex &center = d->model->indexForUrl(d->centerUrl);
+        if (center.isValid())
+            setCenterIndex(center);
+        else
+            setCenterIndex(d->model->index(d->validate(d->row), 0, d->rootIndex));
+        d->scrollBar->blockSignals(true);
+        d->scrollBar->setRange(0, qMax(0, d->count-1));
+        d->scrollBar->setValue(qMax(0, d->row));
+        d->scrollBar->blockSignals(false);
+        updateItemsPos();
     });
 }
 
@@ -520,15 +795,7 @@ Flow::dataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
     if (!topLeft.isValid() || !bottomRight.isValid())
         return;
 
-    const int start = topLeft.row();
-    const int end = bottomRight.row();
-    if (d->items.count() > end)
-        for (int i = start; i <= end; ++i)
-        {
-            Item *item = d->items.at(i);
-            item->dirty = true;
-            item->update();
-        }
+    d->markDirty(topLeft.row(), bottomRight.row());
 }
 
 void
@@ -548,17 +815,15 @@ Flow::setCenterIndex(const QModelIndex &idx)
         d->savedCenter = index;
 
     }
-    else if (d->items.count() <= 1)
+    else if (d->count <= 1)
     {
         d->savedRow = 0;
-        d->nextRow = 0;
         d->row = 0;
     }
     d->centerUrl = d->model->urlForIndex(index);
     d->prevCenter = d->centerIndex;
     d->centerIndex = index;
-    d->nextRow = d->row;
-    d->row = qMin(index.row(), d->items.count()-1);
+    d->row = qMin(index.row(), d->count-1);
     d->textItem->setText(index.data().toString());
     d->textItem->setZValue(d->items.count()+2);
     d->gfxProxy->setZValue(d->items.count()+2);
@@ -572,9 +837,38 @@ Flow::reset()
     if (d->model && d->model->rowCount(d->rootIndex))
     {
         d->populate(0, d->model->rowCount(d->rootIndex)-1);
-        d->scrollBar->setRange(0, d->items.count()-1);
-        d->scrollBar->setValue(qBound(0, d->savedRow, d->items.count()-1));
+        d->populateTimer->stop();
+        flushRows();
+    }
+}
+
+void
+Flow::flushRows()
+{
+    if (!d->count)
+        return;
+
+    QModelIndex index;
+    if (d->userMoved && d->centerUrl.isValid())
+        index = d->model->indexForUrl(d->centerUrl);
+    if (!index.isValid())
+        index = d->model->index(d->validate(d->userMoved ? d->row : d->savedRow), 0, d->rootIndex);
+    setCenterIndex(index);
+
+    d->scrollBar->blockSignals(true);
+    d->scrollBar->setRange(0, d->count-1);
+    d->scrollBar->setValue(d->row);
+    d->scrollBar->blockSignals(false);
+
+    //a running animation keeps going, it only needs the window to follow
+    if (d->clock->isActive())
+    {
+        d->syncWindow();
+        d->layout();
     }
+    else
+        updateItemsPos();
+    d->prefetch();
 }
 
 void
@@ -619,21 +913,26 @@ Flow::rowsRemoved(const QModelIndex &parent, int start, int end)
     if (parent != d->rootIndex)
         return;
 
-    if (d->items.isEmpty())
+    if (!d->count)
         return;
 
-    d->timeLine->stop();
+    d->clock->stop();
+    d->velocity = 0.0f;
 
-    for (int i = end; i >= start; --i)
-        if (i < d->items.size())
-            delete d->items.takeAt(i);
+    d->count -= qMin(d->count, end-start+1);
+    d->remapRows();
+    if (!d->count)
+    {
+        d->row = -1;
+        d->releaseAll();
+    }
 
     d->scrollBar->blockSignals(true);
-    d->scrollBar->setRange(0, d->items.count()-1);
+    d->scrollBar->setRange(0, d->count-1);
     d->scrollBar->setValue(d->validate(start-1));
     d->scrollBar->blockSignals(false);
     QModelIndex center = d->model->index(d->validate(start-1), 0, d->rootIndex);
-    if (d->items.count() == 1)
+    if (d->count == 1)
         center = d->model->index(0, 0, parent);
     setCenterIndex(center);
     updateItemsPos();
@@ -658,77 +957,25 @@ Flow::rowsInserted(const QModelIndex &parent, int start, int end)
         return;
 
     d->populate(start, end);
-
-    if (!d->items.isEmpty())
-        d->scrollBar->setRange(0, d->items.count()-1);
 }
 
 void
 Flow::updateItemsPos()
 {
-    if (d->items.isEmpty()
+    if (!d->count
          || d->row == -1
-         || d->row > d->model->rowCount(d->rootIndex)-1
-         || !isVisible())
+         || d->row > d->model->rowCount(d->rootIndex)-1)
         return;
 
-    d->timeLine->stop();
-    Item *center = d->items.at(d->row);
-    center->setZValue(d->items.count());
-    center->setPos(d->x-SIZE/2.0f, d->y);
-    center->resetTransform();
-
-    if (d->items.count() > 1)
-        correctItemsPos(d->row-1, d->row+1);
-}
-
-void
-Flow::correctItemsPos(const int leftStart, const int rightStart)
-{
-    int z = d->items.count()-1;
-    Item *p = 0;
-    QList<Item *>::iterator i = d->items.begin()+rightStart;
-    if (i < d->items.end())
-    {
-        p = *i;
-        p->setPos(rect().center().x()+space, d->y);
-        p->transform(ANGLE, Qt::YAxis, SCALE, SCALE);
-        d->xpos = p->x();
-        p->setZValue(z);
-        while (++i < d->items.end()) //right side
-        {
-            --z;
-            p = *i;
-            p->setPos(d->xpos+=space, d->y);
-            p->transform(ANGLE, Qt::YAxis, SCALE, SCALE);
-            p->setZValue(z);
-        }
-    }
-    d->xpos = 0.0f;
-    z = d->items.count()-1;
-    i = d->items.begin()+leftStart;
-    if (i > d->items.begin()-1)
-    {
-        p = *i;
-        p->setPos((rect().center().x()-SIZE)-space, d->y);
-        p->transform(-ANGLE, Qt::YAxis, SCALE, SCALE);
-        d->xpos = p->x();
-        p->setZValue(z);
-
-        while (--i > d->items.begin()-1) //left side
-        {
-            --z;
-            p = *i;
-            p->setPos(d->xpos-=space, d->y);
-            p->transform(-ANGLE, Qt::YAxis, SCALE, SCALE);
-            p->setZValue(z);
-        }
-    }
-    p = 0;
-    d->xpos = 0.0f;
+    d->clock->stop();
+    d->velocity = 0.0f;
+    d->pos = d->target = d->row;
+    //even hidden the window has to follow the rows
+    d->syncWindow();
+    if (isVisible())
+        d->layout();
 }
 
-
 void
 Flow::mousePressEvent(QMouseEvent *event)
 {
@@ -736,8 +983,13 @@ Flow::mousePressEvent(QMouseEvent *event)
     d->pressed = itemAt(event->pos());
     if (!d->pressed)
     {
+        //grab the center, it stops where it is
         d->wantsDrag = true;
         d->pressPos = event->pos();
+        d->dragClock.start();
+        d->clock->stop();
+        d->velocity = 0.0f;
+        d->target = d->pos;
     }
 }
 
@@ -747,7 +999,7 @@ Flow::mouseReleaseEvent(QMouseEvent *event)
     QGraphicsView::mouseReleaseEvent(event);
     if (d->pressed && itemAt(event->pos()) == d->pressed)
     {
-        const QModelIndex &index = indexOfItem(static_cast<Item *>(d->pressed));
+        const QModelIndex &index = indexOfItem(qgraphicsitem_cast<Item *>(d->pressed));
         if (index.isValid())
         {
             if (index != d->centerIndex)
@@ -756,6 +1008,13 @@ Flow::mouseReleaseEvent(QMouseEvent *event)
             }
         }
     }
+    if (d->wantsDrag)
+    {
+        //fling, a critically damped spring carries velocity/omega further
+        if (d->dragClock.elapsed() > 100) //held still before letting go
+            d->velocity = 0.0f;
+        d->retarget(qRound(d->pos + d->velocity/omega));
+    }
     d->wantsDrag = false;
 }
 
@@ -765,7 +1024,7 @@ Flow::mouseDoubleClickEvent(QMouseEvent *event)
     QGraphicsView::mouseDoubleClickEvent(event);
     if (d->pressed && itemAt(event->pos()) == d->pressed)
     {
-        const QModelIndex &index = indexOfItem(static_cast<Item *>(d->pressed));
+        const QModelIndex &index = indexOfItem(qgraphicsitem_cast<Item *>(d->pressed));
         if (index.isValid() && index == d->centerIndex)
         {
             emit opened(index);
@@ -779,6 +1038,14 @@ Flow::mouseMoveEvent(QMouseEvent *event)
     QGraphicsView::mouseMoveEvent(event);
     if (!d->wantsDrag)
         return;
+    if (d->count)
+    {
+        const float rows = (d->pressPos.x()-event->pos().x())/(space*qMax(0.1f, (float)d->rootItem->scale()));
+        const float dt = qMax<qint64>(1, d->dragClock.restart())/1000.0f;
+        d->velocity = 0.8f*(rows/dt) + 0.2f*d->velocity;
+        d->moveCenter(d->pos+rows);
+        d->target = d->pos;
+    }
     if (event->pos().y() < d->pressPos.y())
         d->perception -= qAbs(event->pos().y() - d->pressPos.y())*0.1;
     else
@@ -795,48 +1062,34 @@ Flow::showCenterIndex(const QModelIndex &index)
         return;
     if (!isVisible()) //not visible... we silently update the index w/o animations
     {
+        d->userMoved = true;
         setCenterIndex(index);
         updateItemsPos();
         return;
     }
 
-    d->newRow = index.row();
-
-    if (d->newRow == d->row)
-        return;
-
-    if (qAbs(d->newRow-d->row) > 10)
-    {
-        int i = d->newRow > d->row ? -10 : +10;
-        d->timeLine->stop();
-        setCenterIndex(d->model->index(d->newRow+i, 0, d->rootIndex));
-        updateItemsPos();
-        showCenterIndex(d->model->index(d->newRow, 0, d->rootIndex));
-        return;
-    }
-    if (d->timeLine->state() & QTimeLine::Running)
-        return;
-    if (d->newRow > d->row)
-        showNext();
-    else if (d->newRow < d->row)
-        showPrevious();
+    d->retarget(d->validate(index.row()));
 }
 
 void
 Flow::clear()
 {
-    d->timeLine->stop();
+    d->clock->stop();
+    d->populateTimer->stop();
+    d->userMoved = false;
+    d->velocity = d->wheelRest = 0.0f;
     d->centerIndex = QModelIndex();
     d->prevCenter = QModelIndex();
     d->row = -1;
-    d->nextRow = -1;
-    d->newRow = -1;
+    d->pos = d->target = 0.0f;
     d->pressed = 0;
     d->savedRow = -1;
     d->savedCenter = QModelIndex();
     d->centerUrl = QUrl();
     d->savedRow = 0;
-    qDeleteAll(d->items);
+    d->count = 0;
+    d->releaseAll();
+    d->prefetched.clear();
     d->textItem->setText(QString("--"));
     d->scrollBar->setValue(0);
     d->scrollBar->setRange(0, 0);
@@ -845,8 +1098,8 @@ Flow::clear()
 void
 Flow::scrollBarMoved(const int value)
 {
-    if (d->items.count())
-        showCenterIndex(d->model->index(qBound(0, value, d->items.count()), 0, d->rootIndex));
+    if (d->count)
+        showCenterIndex(d->model->index(qBound(0, value, d->count-1), 0, d->rootIndex));
 }
 
 void
@@ -873,7 +1126,60 @@ Flow::animateCenterIndex(const QModelIndex &index)
 
 bool
 Flow::isAnimating() const
-{ return bool(d->timeLine->state() == QTimeLine::Running); }
+{ return d->clock->isActive(); }
+
+bool
+Flow::softwareRendering() const
+{ return d->software; }
+
+void
+Flow::drawBackground(QPainter *painter, const QRectF &rect)
+{
+    QGraphicsView::drawBackground(painter, rect);
+    if (!d->software || d->items.isEmpty())
+        return;
+
+    //the items are still there for picking and for telling the
+    //view what to repaint, the covers are warped into our own
+    //backing store and that goes under everything else
+    const qreal dpr = devicePixelRatioF();
+    const QSize size = viewport()->size()*dpr;
+    if (d->backingStore.size() != size)
+        d->backingStore = QImage(size, QImage::Format_ARGB32_Premultiplied);
+    const QRect exposed = QTransform::fromScale(dpr, dpr).mapRect(mapFromScene(rect).boundingRect().adjusted(-1, -1, 1, 1)) & d->backingStore.rect();
+    if (exposed.isEmpty())
+        return;
+    for (int y = exposed.top(); y <= exposed.bottom(); ++y)
+        memset(d->backingStore.scanLine(y)+exposed.left()*4, 0, exposed.width()*4);
+
+    QList<Item *> covers = d->items;
+    std::sort(covers.begin(), covers.end(), [](const Item *a, const Item *b) { return a->zValue() < b->zValue(); });
+    const QTransform toDevice = QTransform::fromScale(dpr, dpr);
+    for (int i = 0; i < covers.count(); ++i)
+    {
+        Item *item = covers.at(i);
+        if (!item->isVisible())
+            continue;
+        if (item->dirty)
+            item->updateIcon();
+        const QTransform itemToDevice = item->deviceTransform(viewportTransform())*toDevice;
+        const QRect targets[2] = { item->pixRect(), item->refRect() };
+        for (int j = 0; j < 2; ++j)
+        {
+            const QImage &img = item->img[j];
+            if (img.isNull())
+                continue;
+            const QRect &r = targets[j];
+            const QTransform imgToItem = QTransform().translate(r.x(), r.y()).scale(qreal(r.width())/img.width(), qreal(r.height())/img.height());
+            FX::warp(d->backingStore, img, imgToItem*itemToDevice, exposed);
+        }
+    }
+
+    painter->save();
+    painter->resetTransform();
+    painter->drawImage(QRectF(QPointF(exposed.topLeft())/dpr, QSizeF(exposed.size())/dpr), d->backingStore, exposed);
+    painter->restore();
+}
 
 float
 Flow::y() const
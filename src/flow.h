@@ -23,13 +23,14 @@
 #define FLOW_H
 
 #include <QGraphicsView>
+#include "cachegovernor.h"
 
 class QModelIndex;
 class QItemSelectionModel;
 namespace DocSurf
 {
 namespace FS { class ProxyModel; }
-class Flow : public QGraphicsView
+class Flow : public QGraphicsView, public Cacheable
 {
     class Item;
     friend class Item;
@@ -40,7 +41,6 @@ class Flow : public QGraphicsView
     friend class GraphicsScene;
     Q_OBJECT
 public:
-    enum Pos { Prev = 0, New = 1 };
     explicit Flow(QWidget *parent = 0);
     ~Flow();
     void setModel(FS::ProxyModel *model);
@@ -50,9 +50,13 @@ public:
     void animateCenterIndex(const QModelIndex &index);
     QModelIndex indexOfItem(Item *item) const;
     bool isAnimating() const;
+    bool softwareRendering() const;
     float y() const;
     QList<Item *> &items() const;
     QColor &bg() const;
+    QString cacheName() const;
+    qint64 cacheCost() const;
+    void shrinkCache(const qint64 bytes);
     
 Q_SIGNALS:
     void centerIndexChanged(const QModelIndex &centerIndex);
@@ -71,21 +75,18 @@ protected:
     void mouseReleaseEvent(QMouseEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
     void enterEvent(QEvent *e);
-    void prepareAnimation();
-    void correctItemsPos(const int leftStart, const int rightStart);
-    void showPrevious();
-    void showNext();
+    void drawBackground(QPainter *painter, const QRectF &rect);
 
 private Q_SLOTS:
     void dataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
     void rowsInserted(const QModelIndex &parent, int start, int end);
     void rowsRemoved(const QModelIndex &parent, int start, int end);
     void clear();
-    void animStep(const qreal value);
+    void animStep();
     void updateItemsPos();
     void scrollBarMoved(const int value);
-    void continueIf();
     void updateScene();
+    void flushRows();
 
 private:
     class Private;
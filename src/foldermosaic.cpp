@@ -0,0 +1,154 @@
+/**************************************************************************
+*   Copyright (C) 2013 by Robert Metsaranta                               *
+*   therealestrob@gmail.com                                               *
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program; if not, write to the                         *
+*   Free Software Foundation, Inc.,                                       *
+*   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+***************************************************************************/
+
+
+#include <QRunnable>
+#include <QThread>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QPainter>
+
+#include "foldermosaic.h"
+
+using namespace DocSurf;
+using namespace FS;
+
+class MosaicTask : public QRunnable
+{
+public:
+    MosaicTask(MosaicLoader *loader, const QUrl &url, const QStringList &filters)
+        : QRunnable()
+        , m_loader(loader)
+        , m_url(url)
+        , m_filters(filters)
+    {
+    }
+    void run()
+    {
+        QThread::currentThread()->setPriority(QThread::LowestPriority);
+        QList<QImage> thumbs;
+        int scanned(0);
+        QDirIterator it(m_url.toLocalFile(), m_filters, QDir::Files|QDir::Readable);
+        while (it.hasNext() && thumbs.count() < MosaicLoader::MaxImages && scanned++ < MosaicLoader::MaxScanned)
+        {
+            const QImage &thumb = cachedThumb(QFileInfo(it.next()));
+            if (!thumb.isNull())
+                thumbs << thumb;
+        }
+        QMetaObject::invokeMethod(m_loader, "mosaicReady", Qt::QueuedConnection, Q_ARG(QUrl, m_url), Q_ARG(QImage, compose(thumbs)), Q_ARG(int, thumbs.count()));
+    }
+
+private:
+    /* freedesktop thumbnail spec, the file name is the md5 of
+     * the uri and the thumb is only valid while Thumb::MTime
+     * matches the mtime of the file.
+     */
+    static QImage cachedThumb(const QFileInfo &file)
+    {
+        static const QString cacheDir(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/thumbnails/"));
+        static const char *sizes[] = { "normal/", "large/" };
+        const QString name(QString::fromLatin1(QCryptographicHash::hash(QUrl::fromLocalFile(file.absoluteFilePath()).toEncoded(), QCryptographicHash::Md5).toHex()) + QLatin1String(".png"));
+        const QString mtime(QString::number(file.lastModified().toMSecsSinceEpoch()/1000));
+        for (int i = 0; i < 2; ++i)
+        {
+            QImageReader reader(cacheDir + QLatin1String(sizes[i]) + name, "png");
+            if (!reader.canRead() || reader.text("Thumb::MTime") != mtime)
+                continue;
+            const QImage &img = reader.read();
+            if (!img.isNull())
+                return img;
+        }
+        return QImage();
+    }
+    static QImage compose(const QList<QImage> &thumbs)
+    {
+        if (thumbs.isEmpty())
+            return QImage();
+        QImage img(MosaicLoader::Extent, MosaicLoader::Extent, QImage::Format_ARGB32_Premultiplied);
+        img.fill(Qt::transparent);
+        QPainter p(&img);
+        p.setRenderHint(QPainter::SmoothPixmapTransform);
+        const int cell = thumbs.count() == 1 ? MosaicLoader::Extent : MosaicLoader::Extent/2;
+        for (int i = 0; i < thumbs.count(); ++i)
+        {
+            const QRect cellRect(QRect((i%2)*cell, (i/2)*cell, cell, cell).adjusted(1, 1, -1, -1));
+            QRect r(QPoint(), thumbs.at(i).size().scaled(cellRect.size(), Qt::KeepAspectRatio));
+            r.moveCenter(cellRect.center());
+            p.drawImage(r, thumbs.at(i));
+        }
+        p.end();
+        return img;
+    }
+    MosaicLoader *m_loader;
+    QUrl m_url;
+    QStringList m_filters;
+};
+
+MosaicLoader::MosaicLoader(QObject *parent)
+    : QObject(parent)
+{
+    //one folder at a time, this is a nicety and should never compete with the previews
+    m_pool.setMaxThreadCount(1);
+    const QList<QByteArray> formats(QImageReader::supportedImageFormats());
+    for (int i = 0; i < formats.count(); ++i)
+        m_imageFilters << QString("*.%1").arg(QString::fromLatin1(formats.at(i)));
+}
+
+MosaicLoader::~MosaicLoader()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+void
+MosaicLoader::requestMosaic(const KFileItem &dir)
+{
+    if (!dir.isDir() || !dir.isLocalFile() || dir.isSlow())
+        return;
+    const QUrl &url = dir.url();
+    const QDateTime &mtime = dir.time(KFileItem::ModificationTime);
+    if (m_pending.contains(url) || (m_stamps.contains(url) && m_stamps.value(url) == mtime))
+        return;
+    m_pending.insert(url, mtime);
+    m_pool.start(new MosaicTask(this, url, m_imageFilters));
+}
+
+void
+MosaicLoader::childPreviewed(const QUrl &dir)
+{
+    //its thumbnail may be one the mosaic was missing
+    if (m_incomplete.remove(dir))
+        m_stamps.remove(dir);
+}
+
+void
+MosaicLoader::mosaicReady(const QUrl &url, const QImage &img, const int images)
+{
+    m_stamps.insert(url, m_pending.take(url));
+    if (images < MaxImages)
+        m_incomplete.insert(url);
+    else
+        m_incomplete.remove(url);
+    emit mosaicLoaded(url, img.isNull() ? QPixmap() : QPixmap::fromImage(img));
+}
@@ -0,0 +1,80 @@
+/**************************************************************************
+*   Copyright (C) 2013 by Robert Metsaranta                               *
+*   therealestrob@gmail.com                                               *
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program; if not, write to the                         *
+*   Free Software Foundation, Inc.,                                       *
+*   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+***************************************************************************/
+
+
+#ifndef FOLDERMOSAIC_H
+#define FOLDERMOSAIC_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <QDateTime>
+#include <QStringList>
+#include <QPixmap>
+#include <QImage>
+#include <QHash>
+#include <QSet>
+#include <QUrl>
+
+#include <KFileItem>
+
+namespace DocSurf
+{
+
+namespace FS
+{
+
+/* Builds folder previews, a 2x2 mosaic of the first images
+ * inside a local directory. Only already cached thumbnails
+ * from the freedesktop thumbnail cache are used, nothing gets
+ * decoded from the images themselves. Work is done one folder
+ * at a time on a single low priority thread and only for the
+ * folders that are actually asked for, i.e. painted.
+ * A mosaic is rebuilt when the folder mtime changes, one with
+ * less than MaxImages also when a file inside got a thumbnail.
+ */
+class MosaicLoader : public QObject
+{
+    Q_OBJECT
+public:
+    enum { Extent = 256, MaxImages = 4, MaxScanned = 256 };
+    explicit MosaicLoader(QObject *parent = 0);
+    ~MosaicLoader();
+    void requestMosaic(const KFileItem &dir);
+    /* a file directly in dir got a thumbnail */
+    void childPreviewed(const QUrl &dir);
+
+signals:
+    void mosaicLoaded(const QUrl &url, const QPixmap &pix);
+
+private slots:
+    void mosaicReady(const QUrl &url, const QImage &img, const int images);
+
+private:
+    QThreadPool m_pool;
+    QStringList m_imageFilters;
+    QHash<QUrl, QDateTime> m_stamps, m_pending;
+    QSet<QUrl> m_incomplete; //stamped with less than MaxImages thumbnails
+};
+
+}
+
+}
+
+#endif // FOLDERMOSAIC_H
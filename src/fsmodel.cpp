@@ -34,6 +34,8 @@
 #include <QLabel>
 #include <QDebug>
 #include <QMap>
+#include <QSet>
+#include <QMimeDatabase>
 #include <QWaitCondition>
 #include <QMenu>
 #include <QString>
@@ -61,6 +63,7 @@
 
 #include <KF5/KCoreAddons/KPluginLoader>
 #include <KService/KService>
+#include <KService/KServiceTypeTrader>
 #include <KService/KServiceType>
 #include <KParts/KParts/ReadOnlyPart>
 #include <KParts/KParts/ReadWritePart>
@@ -68,6 +71,10 @@
 #include <KParts/Plugin>
 
 #include "fsmodel.h"
+#include "imagepreparer.h"
+#include "iconprovider.h"
+#include "foldermosaic.h"
+#include "largeimages.h"
 
 using namespace DocSurf;
 using namespace FS;
@@ -210,20 +217,131 @@ ProxyModel::count(int &dirs, int &files, qulonglong &bytes)
     return static_cast<DirModel *>(sourceModel())->count(dirs, files, bytes);
 }
 
-QMap<QUrl, QPixmap> DirModel::s_thumbs;
-QList<QUrl> DirModel::s_tried;
+Thumbnail
+ProxyModel::thumbnail(const QModelIndex &index, const int extent) const
+{
+    return m_model->thumbnail(mapToSource(index), extent);
+}
+
+QPixmap
+ProxyModel::iconPixmap(const QModelIndex &index, const QSize &size) const
+{
+    return m_model->iconPixmap(mapToSource(index), size);
+}
+
+void
+ProxyModel::cancelThumbnails(const QModelIndexList &indexes)
+{
+    QModelIndexList source;
+    for (int i = 0; i < indexes.count(); ++i)
+        source << mapToSource(indexes.at(i));
+    m_model->cancelThumbnails(source);
+}
+
+void
+ProxyModel::setThumbnailExtent(const int extent)
+{
+    m_model->setThumbnailExtent(extent);
+}
+
+QHash<QUrl, Thumbnail> DirModel::s_thumbs;
+QHash<QUrl, int> DirModel::s_tried;
+QList<DirModel *> DirModel::s_models;
+
+/* the thumbnails are shared by all models so
+ * they are governed as one cache of their own
+ */
+class ThumbnailCache : public Cacheable
+{
+public:
+    ThumbnailCache() : Cacheable(Expensive) {}
+    QString cacheName() const { return "thumbnails"; }
+    qint64 cacheCost() const { return DirModel::thumbnailBytes(); }
+    void shrinkCache(const qint64 bytes) { DirModel::shrinkThumbnails(bytes); }
+};
+static ThumbnailCache s_thumbnailCache;
 
 DirModel::DirModel(QObject *parent)
     : KDirModel(parent)
+    , Cacheable(Precious)
     , m_previewLoader(new PreviewLoader(this))
+    , m_mosaicLoader(new MosaicLoader(this))
+    , m_thumbExtent(Thumbnail::MaxExtent)
 {
+    s_models << this;
     setDirLister(new DirLister(this));
     setDropsAllowed(KDirModel::DropOnDirectory);
     connect(m_previewLoader, &PreviewLoader::previewLoaded, this, &DirModel::slotPreviewLoaded);
+    connect(ImagePreparer::instance(), &ImagePreparer::ready, this, &DirModel::slotImagePrepared);
+    connect(m_mosaicLoader, &MosaicLoader::mosaicLoaded, this, &DirModel::slotMosaicLoaded);
+    connect(dirLister(), &KDirLister::itemsAdded, this, &DirModel::slotItemsAdded);
 }
 
 DirModel::~DirModel()
 {
+    s_models.removeOne(this);
+}
+
+QString
+DirModel::cacheName() const
+{
+    return QString("listing %1").arg(currentUrl().toDisplayString());
+}
+
+qint64
+DirModel::cacheCost() const
+{
+    //rough, a KFileItem with its udsentry is around a kilobyte
+    const QList<QUrl> &dirs = dirLister()->directories();
+    qint64 items(0);
+    for (int i = 0; i < dirs.count(); ++i)
+        items += dirLister()->itemsForDir(dirs.at(i)).count();
+    return items*1024;
+}
+
+void
+DirModel::shrinkCache(const qint64 bytes)
+{
+    //the listings back what the views show, nothing to give back
+    Q_UNUSED(bytes);
+}
+
+qint64
+DirModel::thumbnailBytes()
+{
+    qint64 bytes(0);
+    for (QHash<QUrl, Thumbnail>::const_iterator it = s_thumbs.constBegin(), end = s_thumbs.constEnd(); it != end; ++it)
+        bytes += it.value().byteCount();
+    return bytes;
+}
+
+void
+DirModel::shrinkThumbnails(const qint64 bytes)
+{
+    QList<QUrl> listed;
+    for (int i = 0; i < s_models.count(); ++i)
+        listed << s_models.at(i)->dirLister()->directories();
+
+    //first whatever is not in a listed directory, then the rest,
+    //dropped thumbnails are simply requested again when painted.
+    //the governor only asks expensive caches when all of them are
+    //over the cache budget, never for pressure or rss alone
+    qint64 released(0);
+    for (int pass = 0; pass < 2 && released < bytes; ++pass)
+    {
+        QHash<QUrl, Thumbnail>::iterator it = s_thumbs.begin();
+        while (it != s_thumbs.end() && released < bytes)
+        {
+            if (!pass && listed.contains(it.key().adjusted(QUrl::RemoveFilename|QUrl::StripTrailingSlash)))
+            {
+                ++it;
+                continue;
+            }
+            released += it.value().byteCount();
+            s_tried.remove(it.key());
+            it = s_thumbs.erase(it);
+        }
+    }
 }
 
 void
@@ -249,8 +367,80 @@ void
 DirModel::slotPreviewLoaded(const KFileItem &file, const QPixmap &pix)
 {
     const QModelIndex &index = indexForItem(file);
-    s_thumbs.insert(file.url(), pix);
+    const Thumbnail thumb(pix);
+    //previews for a smaller extent can arrive after a bigger one
+    if (thumb.topLevel() < s_thumbs.value(file.url()).topLevel())
+        return;
+    s_thumbs.insert(file.url(), thumb);
     emit dataChanged(index, index, QVector<int>() << Qt::DecorationRole);
+    //the thumbnailer stored it in the thumbnail cache too, where the
+    //mosaics of the folder it is in look, whatever model shows those
+    const QUrl &dir = file.url().adjusted(QUrl::RemoveFilename|QUrl::StripTrailingSlash);
+    for (int i = 0; i < s_models.count(); ++i)
+        s_models.at(i)->m_mosaicLoader->childPreviewed(dir);
+}
+
+void
+DirModel::slotMosaicLoaded(const QUrl &url, const QPixmap &pix)
+{
+    if (pix.isNull())
+    {
+        //folder lost its images since the last mosaic
+        if (!s_thumbs.remove(url))
+            return;
+    }
+    else
+        s_thumbs.insert(url, Thumbnail(pix));
+    const QModelIndex &index = indexForUrl(url);
+    if (index.isValid())
+        emit dataChanged(index, index, QVector<int>() << Qt::DecorationRole);
+}
+
+void
+DirModel::slotItemsAdded(const QUrl &directory, const KFileItemList &items)
+{
+    Q_UNUSED(directory);
+    //one lookup per file type, not per file. items that do not know
+    //their mimetype yet would have to determine it for iconName(),
+    //they get their icon looked up once they are painted instead
+    QStringList names;
+    for (int i = 0; i < items.count(); ++i)
+    {
+        const KFileItem &item = items.at(i);
+        if (!item.isMimeTypeKnown() || !item.overlays().isEmpty())
+            continue;
+        const QString &name = item.iconName();
+        if (!m_iconNames.contains(name))
+        {
+            m_iconNames.insert(name);
+            names << name;
+        }
+    }
+    warmIcons(names);
+}
+
+void
+DirModel::warmIcons(const QStringList &names)
+{
+    const int size = qRound(m_thumbExtent/qApp->devicePixelRatio());
+    IconCache::instance()->warmThemed(names, QSize(size, size));
+}
+
+void
+DirModel::setThumbnailExtent(const int extent)
+{
+    if (extent == m_thumbExtent)
+        return;
+    m_thumbExtent = extent;
+    warmIcons(m_iconNames.toList());
+}
+
+void
+DirModel::slotImagePrepared(const QUrl &url)
+{
+    const QModelIndex &index = indexForUrl(url);
+    if (index.isValid())
+        emit dataChanged(index, index, QVector<int>() << Qt::DecorationRole);
 }
 
 QVariant
@@ -288,20 +478,72 @@ DirModel::data(const QModelIndex &index, int role) const
 
     }
     if (role == Qt::DecorationRole && index.column() == 0)
-    if (dirLister()->isFinished())
     {
+        const Thumbnail &thumb = thumbnail(index, m_thumbExtent);
+        if (!thumb.isNull())
+            return thumb.icon();
+        //overlaid icons are rare, KDirModel composes those
         const KFileItem &item = itemForIndex(index);
-        if (s_thumbs.contains(item.url()))
-            return QIcon(s_thumbs.value(item.url()));
-        if (!s_tried.contains(item.url()))
-        {
-            s_tried << item.url();
-            m_previewLoader->requestPreview(item);
-        }
+        if (!item.isNull() && item.overlays().isEmpty())
+            return IconCache::instance()->themed(item.iconName());
     }
     return KDirModel::data(index, role);
 }
 
+QPixmap
+DirModel::iconPixmap(const QModelIndex &index, const QSize &size) const
+{
+    const KFileItem &item = itemForIndex(index);
+    if (item.isNull())
+        return QPixmap();
+    if (!item.overlays().isEmpty())
+        return data(index, Qt::DecorationRole).value<QIcon>().pixmap(size);
+    return IconCache::instance()->themedPixmap(item.iconName(), size);
+}
+
+Thumbnail
+DirModel::thumbnail(const QModelIndex &index, const int extent) const
+{
+    if (!index.isValid())
+        return Thumbnail();
+    const KFileItem &item = itemForIndex(index);
+    const QUrl &url = item.url();
+    const Thumbnail thumb = s_thumbs.value(url);
+    if (item.isDir())
+    {
+        if (dirLister()->isFinished())
+            m_mosaicLoader->requestMosaic(item);
+        return thumb;
+    }
+    const int level = Thumbnail::levelForExtent(extent);
+    //only ask for a bigger level once, a preview smaller then
+    //the level asked for means the source image is that small
+    if (dirLister()->isFinished() && thumb.topLevel() < level && s_tried.value(url, -1) < level)
+    {
+        s_tried.insert(url, level);
+        m_previewLoader->requestPreview(item, Thumbnail::extentForLevel(level));
+    }
+    return thumb;
+}
+
+void
+DirModel::cancelThumbnails(const QModelIndexList &indexes)
+{
+    QSet<QUrl> urls;
+    for (int i = 0; i < indexes.count(); ++i)
+    {
+        const KFileItem &item = itemForIndex(indexes.at(i));
+        if (!item.isNull() && !item.isDir())
+            urls << item.url();
+    }
+    if (urls.isEmpty())
+        return;
+    //never loaded, so they get asked for again once they are painted
+    const QList<QUrl> &dropped = m_previewLoader->cancelPreviews(urls);
+    for (int i = 0; i < dropped.count(); ++i)
+        s_tried.remove(dropped.at(i));
+}
+
 QUrl
 DirModel::urlForIndex(const QModelIndex &index) const
 {
@@ -316,6 +558,7 @@ DirModel::urlForIndex(const QModelIndex &index) const
 void
 DirModel::setCurrentUrl(const QUrl &url)
 {
+    m_iconNames.clear();
     dirLister()->openUrl(url);
 }
 
@@ -400,13 +643,19 @@ DirModel::dropMimeData(const QMimeData *data, Qt::DropAction action, int row, in
     return true;
 }
 
+QHash<QString, PreviewLoader::PluginStats> PreviewLoader::s_stats;
+
 PreviewLoader::PreviewLoader(QObject *parent)
     : QObject(parent)
     , Configurable()
     , m_timer(new QTimer(this))
+    , m_largeImages(new LargeImageLoader(this))
 {
     m_timer->setInterval(100);
+    m_timer->setSingleShot(true);
     connect(m_timer, &QTimer::timeout, this, &PreviewLoader::loadPreviews);
+    connect(m_largeImages, &LargeImageLoader::previewLoaded, this, &PreviewLoader::previewLoaded);
+    connect(m_largeImages, &LargeImageLoader::declined, this, &PreviewLoader::queuePreview);
     reconfigure();
 }
 
@@ -421,26 +670,189 @@ PreviewLoader::reconfigure()
     m_plugins = config.readEntry("PreviewPlugins", KIO::PreviewJob::defaultPlugins());
     m_loadRemote = config.readEntry("RemotePreviews", false);
     m_queue.clear();
+    m_queued.clear();
+    m_mimePlugins.clear();
     DirModel::tried().clear();
 }
 
+QString
+PreviewLoader::pluginForItem(const KFileItem &file)
+{
+    //same lookup PreviewJob does internally, we only need the
+    //name to batch per thumbnailer and to account time to it
+    const QString &mime = file.mimetype();
+    if (m_mimePlugins.contains(mime))
+        return m_mimePlugins.value(mime);
+    QString plugin("none");
+    //thumbnailers cover subclasses too, image/x-canon-cr2 through image/x-dcraw say
+    const QMimeType &mimeType = QMimeDatabase().mimeTypeForName(mime);
+    const KService::List plugins = KServiceTypeTrader::self()->query("ThumbCreator");
+    for (int i = 0; i < plugins.count() && plugin == "none"; ++i)
+    {
+        const KService::Ptr &service = plugins.at(i);
+        if (!m_plugins.contains(service->desktopEntryName()))
+            continue;
+        const QStringList &types = service->property("MimeType").toStringList();
+        for (int t = 0; t < types.count(); ++t)
+        {
+            const QString &type = types.at(t);
+            if (type == mime
+                    || (type.endsWith("/*") && mime.startsWith(type.left(type.size()-1)))
+                    || (mimeType.isValid() && mimeType.inherits(type)))
+            {
+                plugin = service->desktopEntryName();
+                break;
+            }
+        }
+    }
+    m_mimePlugins.insert(mime, plugin);
+    return plugin;
+}
+
+int
+PreviewLoader::batchSize(const QString &plugin) const
+{
+    const int avg = s_stats.value(plugin).avgMs;
+    if (!avg)
+        return ProbeBatch;
+    return qBound(1, TargetBatchMs/avg, (int)MaxBatch);
+}
+
 void
-PreviewLoader::requestPreview(const KFileItem &file)
+PreviewLoader::requestPreview(const KFileItem &file, const int extent)
 {
-    if (m_queue.contains(file) || (file.isSlow() && !m_loadRemote) || file.isDir())
+    if ((file.isSlow() && !m_loadRemote) || file.isDir())
         return;
-    m_queue << file;
-//    if (!m_timer->isActive())
+    if (LargeImageLoader::handles(file))
+    {
+        m_largeImages->requestPreview(file, extent);
+        return;
+    }
+    queuePreview(file, extent);
+}
+
+void
+PreviewLoader::queuePreview(const KFileItem &file, const int extent)
+{
+    const QPair<QUrl, int> key(file.url(), extent);
+    if (m_queued.contains(key))
+        return;
+    m_queued.insert(key);
+    Request request;
+    request.file = file;
+    request.extent = extent;
+    request.plugin = pluginForItem(file);
+    m_queue << request;
+    if (m_jobs.count() < MaxJobs)
         m_timer->start();
 }
 
+QList<QUrl>
+PreviewLoader::cancelPreviews(const QSet<QUrl> &urls)
+{
+    QList<QUrl> dropped;
+    QList<Request> queue;
+    for (int i = 0; i < m_queue.count(); ++i)
+    {
+        const Request &request = m_queue.at(i);
+        if (!urls.contains(request.file.url()))
+        {
+            queue << request;
+            continue;
+        }
+        m_queued.remove(qMakePair(request.file.url(), request.extent));
+        dropped << request.file.url();
+    }
+    m_queue = queue;
+    return dropped;
+}
+
 void
 PreviewLoader::loadPreviews()
 {
 //    qDebug() << "loading previews for" << m_queue.size() << "files...";
-    KIO::PreviewJob *job = KIO::filePreview(m_queue, QSize(256, 256), &m_plugins);
-    connect(job, &KIO::PreviewJob::gotPreview, this, &PreviewLoader::previewLoaded);
-//    connect(job, &KIO::PreviewJob::finished, job, &QObject::deleteLater); //jobs delete themselves when finished
-    m_queue.clear();
-    m_timer->stop();
+    //take batches in queue order, each one for a single thumbnailer
+    //and extent, sized so a batch takes about TargetBatchMs
+    while (m_jobs.count() < MaxJobs && !m_queue.isEmpty())
+    {
+        const Request first = m_queue.first();
+        const int size = batchSize(first.plugin);
+        KFileItemList batch;
+        for (int i = 0; i < m_queue.count() && batch.count() < size; )
+        {
+            const Request &r = m_queue.at(i);
+            if (r.extent == first.extent && r.plugin == first.plugin)
+            {
+                batch << r.file;
+                m_queued.remove(qMakePair(r.file.url(), r.extent));
+                m_queue.removeAt(i);
+            }
+            else
+                ++i;
+        }
+        KIO::PreviewJob *job = KIO::filePreview(batch, QSize(first.extent, first.extent), &m_plugins);
+        Job &info = m_jobs[job];
+        info.plugin = first.plugin;
+        info.timer.start();
+        info.last = 0;
+        connect(job, &KIO::PreviewJob::gotPreview, this, [this, job](const KFileItem &file, const QPixmap &pix)
+        {
+            itemDone(job, false);
+            emit previewLoaded(file, pix);
+        });
+        connect(job, &KIO::PreviewJob::failed, this, [this, job](const KFileItem &) { itemDone(job, true); });
+        connect(job, &KJob::result, this, &PreviewLoader::jobDone);
+//        connect(job, &KIO::PreviewJob::finished, job, &QObject::deleteLater); //jobs delete themselves when finished
+    }
+}
+
+void
+PreviewLoader::itemDone(KJob *job, const bool failed)
+{
+    if (!m_jobs.contains(job))
+        return;
+    Job &info = m_jobs[job];
+    const qint64 now = info.timer.elapsed();
+    const int ms = now - info.last;
+    info.last = now;
+
+    PluginStats &stats = s_stats[info.plugin];
+    ++stats.items;
+    if (failed)
+        ++stats.failed;
+    stats.busyMs += ms;
+    stats.avgMs = stats.avgMs ? qMax(1, (stats.avgMs*7 + ms)/8) : qMax(1, ms);
+    int bucket = 0;
+    while (bucket < HistogramBuckets-1 && ms >= (1 << bucket))
+        ++bucket;
+    ++stats.histogram[bucket];
+}
+
+void
+PreviewLoader::jobDone(KJob *job)
+{
+    m_jobs.remove(job);
+    if (!m_queue.isEmpty())
+        loadPreviews();
+}
+
+QString
+PreviewLoader::statistics()
+{
+    QString stats("plugin items failed items/s avg(ms) latency(<1,<2,<4..ms)\n");
+    for (QHash<QString, PluginStats>::const_iterator it = s_stats.constBegin(), end = s_stats.constEnd(); it != end; ++it)
+    {
+        const PluginStats &s = it.value();
+        QStringList histogram;
+        for (int i = 0; i < HistogramBuckets; ++i)
+            histogram << QString::number(s.histogram[i]);
+        stats += QString("%1 %2 %3 %4 %5 %6\n")
+                .arg(it.key())
+                .arg(s.items)
+                .arg(s.failed)
+                .arg(s.busyMs ? s.items*1000.0/s.busyMs : 0.0, 0, 'f', 1)
+                .arg(s.avgMs)
+                .arg(histogram.join(","));
+    }
+    return stats;
 }
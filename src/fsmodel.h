@@ -26,12 +26,18 @@
 #include <KDirLister>
 #include <KDirModel>
 #include "widgets.h"
+#include "thumbnails.h"
+#include "cachegovernor.h"
 
 #include <QSettings>
 #include <QDir>
+#include <QHash>
+#include <QSet>
+#include <QElapsedTimer>
 
 class QFileSystemWatcher;
 class QMenu;
+class KJob;
 
 namespace DocSurf
 {
@@ -72,6 +78,10 @@ public:
     QModelIndex indexForUrl(const QUrl &url) const;
     KFileItem itemForIndex(const QModelIndex &index) const;
     KDirLister *dirLister() const;
+    Thumbnail thumbnail(const QModelIndex &index, const int extent) const;
+    QPixmap iconPixmap(const QModelIndex &index, const QSize &size) const;
+    void cancelThumbnails(const QModelIndexList &indexes);
+    void setThumbnailExtent(const int extent);
 
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
 
@@ -93,18 +103,33 @@ private:
 };
 
 class PreviewLoader;
-class DirModel : public KDirModel
+class MosaicLoader;
+class DirModel : public KDirModel, public Cacheable
 {
     Q_OBJECT
 public:
     explicit DirModel(QObject *parent = 0);
     ~DirModel();
 
+    QString cacheName() const;
+    qint64 cacheCost() const;
+    void shrinkCache(const qint64 bytes);
+    bool isShrinkable() const { return false; }
+    static qint64 thumbnailBytes();
+    static void shrinkThumbnails(const qint64 bytes);
+
     QUrl urlForIndex(const QModelIndex &index) const;
     void setCurrentUrl(const QUrl &url);
     QUrl currentUrl() const;
-    static QList<QUrl> &tried() { return s_tried; }
+    static QHash<QUrl, int> &tried() { return s_tried; }
     void count(int &dirs, int &files, qulonglong &bytes);
+    Thumbnail thumbnail(const QModelIndex &index, const int extent) const;
+    /* the file type icon of index at size, from the session icon cache */
+    QPixmap iconPixmap(const QModelIndex &index, const QSize &size) const;
+    /* drops the queued preview requests of indexes, nothing loading is stopped */
+    void cancelThumbnails(const QModelIndexList &indexes);
+    /* also warms the icons of the listing at the new size */
+    void setThumbnailExtent(const int extent);
 
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
     QStringList mimeTypes() const { return QStringList() << "text/uri-list" << "application/x-kde-ark-dndextract-service" << "application/x-kde-ark-dndextract-path"; }
@@ -112,33 +137,80 @@ public:
 
 protected slots:
     void slotPreviewLoaded(const KFileItem &file, const QPixmap &pix);
+    void slotImagePrepared(const QUrl &url);
+    void slotMosaicLoaded(const QUrl &url, const QPixmap &pix);
+    void slotItemsAdded(const QUrl &directory, const KFileItemList &items);
+
+protected:
+    void warmIcons(const QStringList &names);
 
 private:
     PreviewLoader *m_previewLoader;
-    static QMap<QUrl, QPixmap> s_thumbs;
-    static QList<QUrl> s_tried;
+    MosaicLoader *m_mosaicLoader;
+    int m_thumbExtent;
+    QSet<QString> m_iconNames; //of the listed items whose mimetype is known
+    static QHash<QUrl, Thumbnail> s_thumbs;
+    static QHash<QUrl, int> s_tried; //highest mip level requested per url
+    static QList<DirModel *> s_models;
 };
 
+class LargeImageLoader;
 class PreviewLoader : public QObject, public Configurable
 {
     Q_OBJECT
 public:
+    enum { MaxJobs = 2, MaxBatch = 64, ProbeBatch = 4, TargetBatchMs = 300, HistogramBuckets = 14 };
     PreviewLoader(QObject *parent = 0);
     ~PreviewLoader();
     void reconfigure();
-    void requestPreview(const KFileItem &file);
+    void requestPreview(const KFileItem &file, const int extent = Thumbnail::MaxExtent);
+    /* removes every queued request for urls, returns the urls removed */
+    QList<QUrl> cancelPreviews(const QSet<QUrl> &urls);
+    static QString statistics();
 
 signals:
     void previewLoaded(const KFileItem &file, const QPixmap &pix);
 
 protected slots:
     void loadPreviews();
+    void queuePreview(const KFileItem &file, const int extent);
+
+protected:
+    QString pluginForItem(const KFileItem &file);
+    int batchSize(const QString &plugin) const;
+    void itemDone(KJob *job, const bool failed);
+    void jobDone(KJob *job);
 
 private:
+    struct Request
+    {
+        KFileItem file;
+        int extent;
+        QString plugin;
+    };
+    struct Job
+    {
+        QString plugin;
+        QElapsedTimer timer;
+        qint64 last;
+    };
+    struct PluginStats
+    {
+        PluginStats() : items(0), failed(0), busyMs(0), avgMs(0) { for (int i = 0; i < HistogramBuckets; ++i) histogram[i] = 0; }
+        int items, failed;
+        qint64 busyMs;
+        int avgMs; //running average of the per item latency, sizes the batches
+        int histogram[HistogramBuckets]; //per item latency, bucket n counts < 2^n ms
+    };
     QTimer *m_timer;
-    KFileItemList m_queue;
+    LargeImageLoader *m_largeImages;
+    QList<Request> m_queue;
+    QSet<QPair<QUrl, int> > m_queued; //url and extent of everything in m_queue
+    QHash<KJob *, Job> m_jobs;
+    QHash<QString, QString> m_mimePlugins;
     bool m_loadRemote;
     QStringList m_plugins;
+    static QHash<QString, PluginStats> s_stats;
 };
 
 template<typename T> static inline bool writeDesktopValue(const QDir &dir, const QString &key, T v, const QString &custom = QString())
@@ -1,6 +1,9 @@
 #include "color.h"
 #include <QPalette>
 #include <QApplication>
+#include <QHash>
+#include <QPair>
+#include <math.h>
 
 QColor
 Color::mid(const QColor &c1, const QColor c2, int i1, int i2)
@@ -28,13 +31,13 @@ bool
 Color::contrast(const QColor &c1, const QColor &c2)
 {
     int lum1 = lum(c1), lum2 = lum(c2);
-    if (qAbs(lum2-lum1)<125)
+    if (qAbs(lum2-lum1)<LumLimit)
         return false;
 
     int r(qAbs(c1.red()-c2.red())),
             g(qAbs(c1.green()-c2.green())),
             b(qAbs(c1.blue()-c2.blue()));
-    return (r+g+b>500);
+    return (r+g+b>RgbLimit);
 }
 
 void
@@ -43,6 +46,17 @@ Color::setValue(const int value, QColor &c)
     c.setHsv(c.hue(), c.saturation(), qBound(0, value, 255), c.alpha());
 }
 
+/* c with its value moved by shift, a single setHsv is the same as
+ * shift steps of setValue since the hue and saturation are kept
+ */
+static QColor
+shifted(const QColor &c, const int shift)
+{
+    QColor s(c);
+    Color::setValue(c.value()+shift, s);
+    return s;
+}
+
 void
 Color::ensureContrast(QColor &c1, QColor &c2)
 {
@@ -57,15 +71,86 @@ Color::ensureContrast(QColor &c1, QColor &c2)
         light = c1;
         inv = true;
     }
-    while (!contrast(dark, light))
+
+    /* Darkening one and lightening the other by k in value scales
+     * their channels, so the luma gap is piecewise linear in k with
+     * a kink where either hits its end of the range. The k that
+     * opens it to the limit is solved for directly, then checked
+     * against the real colors since hsv rounding and the rgb
+     * distance may need a few more steps, found by bisection.
+     */
+    const int vd(dark.value()), vl(light.value());
+    const int maxShift(qMax(vd, 255-vl));
+    const float ld(vd ? float(lum(dark))/vd : 0.0f), ll(vl ? float(lum(light))/vl : 0.0f);
+    const int knee(qMin(vd, 255-vl));
+    float k(0.0f);
+    if (ll+ld > 0.0f)
+        k = (LumLimit - ll*vl + ld*vd)/(ll+ld);
+    if (k > knee)
     {
-        setValue(dark.value()-1, dark);
-        setValue(light.value()+1, light);
+        if (vd < 255-vl) //dark is black already, only light moves
+            k = ll > 0.0f ? LumLimit/ll - vl : maxShift;
+        else //light is at the top, only dark moves
+            k = ld > 0.0f ? vd - (255.0f*ll - LumLimit)/ld : maxShift;
     }
+    int shift(qBound(0, int(ceilf(k)), maxShift));
+
+    while (shift > 0 && contrast(shifted(dark, -(shift-1)), shifted(light, shift-1)))
+        --shift;
+    if (!contrast(shifted(dark, -shift), shifted(light, shift)))
+    {
+        //the ends are as far as it goes, some pairs never get there
+        int lo(shift), hi(maxShift);
+        if (contrast(shifted(dark, -hi), shifted(light, hi)))
+            while (hi-lo > 1)
+            {
+                const int mid((lo+hi)/2);
+                if (contrast(shifted(dark, -mid), shifted(light, mid)))
+                    hi = mid;
+                else
+                    lo = mid;
+            }
+        shift = hi;
+    }
+    dark = shifted(dark, -shift);
+    light = shifted(light, shift);
     c1 = inv ? light : dark;
     c2 = inv ? dark : light;
 }
 
+struct ContrastedRoles
+{
+    QColor bg[QPalette::NColorGroups], fg[QPalette::NColorGroups];
+};
+
+void
+Color::ensureContrast(QPalette &pal, const QPalette::ColorRole bg, const QPalette::ColorRole fg)
+{
+    //the cacheKey changes with every change to a palette, so entries never go stale
+    typedef QPair<qint64, int> Key;
+    static QHash<Key, ContrastedRoles> s_resolved;
+    const Key key(pal.cacheKey(), bg*QPalette::NColorRoles+fg);
+    if (!s_resolved.contains(key))
+    {
+        if (s_resolved.count() >= MaxResolved)
+            s_resolved.clear();
+        ContrastedRoles r;
+        for (int g = 0; g < QPalette::NColorGroups; ++g)
+        {
+            r.bg[g] = pal.color(QPalette::ColorGroup(g), bg);
+            r.fg[g] = pal.color(QPalette::ColorGroup(g), fg);
+            ensureContrast(r.bg[g], r.fg[g]);
+        }
+        s_resolved.insert(key, r);
+    }
+    const ContrastedRoles &r = s_resolved.value(key);
+    for (int g = 0; g < QPalette::NColorGroups; ++g)
+    {
+        pal.setColor(QPalette::ColorGroup(g), bg, r.bg[g]);
+        pal.setColor(QPalette::ColorGroup(g), fg, r.fg[g]);
+    }
+}
+
 void
 Color::shiftHue(QColor &c, int amount)
 {
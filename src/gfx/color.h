@@ -2,13 +2,22 @@
 #define COLOR_H
 
 #include <QColor>
+#include <QPalette>
 
 class Q_DECL_EXPORT Color
 {
 public:
+    enum { LumLimit = 125, RgbLimit = 500, MaxResolved = 256 };
     static QColor mid(const QColor &c1, const QColor c2, int i1 = 1, int i2 = 1);
     static bool contrast(const QColor &c1, const QColor &c2);
+    /* darkens the darker and lightens the lighter color just enough
+     * for contrast(), or as far as they go when that is not enough
+     */
     static void ensureContrast(QColor &c1, QColor &c2);
+    /* the same for two roles in every color group of pal, resolved
+     * once per palette and pair of roles
+     */
+    static void ensureContrast(QPalette &pal, const QPalette::ColorRole bg, const QPalette::ColorRole fg);
     static void setValue(const int value, QColor &c);
     static int lum(const QColor &c);
     static void shiftHue(QColor &c, int amount);
@@ -0,0 +1,78 @@
+#include "cpu.h"
+#include <QThreadPool>
+#include <QThread>
+#include <QSemaphore>
+#include <QRunnable>
+#include <QByteArray>
+
+static CPU::Level
+detect()
+{
+    CPU::Level level(CPU::Scalar);
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        level = CPU::SSE2;
+    if (__builtin_cpu_supports("avx2"))
+        level = CPU::AVX2;
+#endif
+    const QByteArray &forced = qgetenv("DOCSURF_SIMD").toLower();
+    if (forced == "scalar" || forced == "none")
+        level = CPU::Scalar;
+    else if (forced == "sse2")
+        level = qMin(level, CPU::SSE2);
+    else if (forced == "avx2") //the same as not set, capped to what the cpu has
+        level = qMin(level, CPU::AVX2);
+    return level;
+}
+
+CPU::Level
+CPU::level()
+{
+    static const Level s_level = detect();
+    return s_level;
+}
+
+class Slice : public QRunnable
+{
+public:
+    Slice(const std::function<void (int, int)> &work, const int begin, const int end, QSemaphore *done)
+        : QRunnable()
+        , m_work(work)
+        , m_begin(begin)
+        , m_end(end)
+        , m_done(done)
+    {
+    }
+    void run()
+    {
+        m_work(m_begin, m_end);
+        m_done->release();
+    }
+
+private:
+    const std::function<void (int, int)> &m_work;
+    int m_begin, m_end;
+    QSemaphore *m_done;
+};
+
+void
+CPU::parallel(const int count, const int grain, const std::function<void (int, int)> &work)
+{
+    //a pool of our own, callers may well be running on the global one
+    static QThreadPool s_pool;
+    const int g(qMax(1, grain));
+    const int threads = qBound(1, count/g, QThread::idealThreadCount());
+    if (threads < 2)
+    {
+        work(0, count);
+        return;
+    }
+    const int step = ((count/threads + g-1)/g)*g;
+    QSemaphore done;
+    int slices(0);
+    for (int begin = step; begin < count; begin += step, ++slices)
+        s_pool.start(new Slice(work, begin, qMin(count, begin+step), &done));
+    work(0, qMin(count, step));
+    done.acquire(slices);
+}
@@ -0,0 +1,22 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <functional>
+
+namespace CPU
+{
+    /* The widest instruction set the pixel kernels may use, detected
+     * once at runtime. DOCSURF_SIMD=scalar|sse2|avx2 lowers it, it is
+     * never raised above what the cpu supports.
+     */
+    enum Level { Scalar = 0, SSE2, AVX2 };
+    Level level();
+
+    /* Runs work over [0, count) in slices of a multiple of grain,
+     * spread over a pool of its own and the calling thread, and
+     * returns when all of them are done. Small counts run inline.
+     */
+    void parallel(const int count, const int grain, const std::function<void (int begin, int end)> &work);
+}
+
+#endif // CPU_H
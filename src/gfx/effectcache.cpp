@@ -0,0 +1,190 @@
+#include "effectcache.h"
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QCoreApplication>
+#include <QThread>
+
+struct EffectKey
+{
+    int effect;
+    qint64 source;
+    quint64 param, extra;
+    bool operator==(const EffectKey &other) const
+    {
+        return effect == other.effect && source == other.source && param == other.param && extra == other.extra;
+    }
+};
+
+inline uint qHash(const EffectKey &key, uint seed = 0)
+{
+    return qHash(key.source, seed) ^ qHash(key.param) ^ (qHash(key.extra) << 1) ^ uint(key.effect << 28);
+}
+
+/* Pixmaps belong to the gui thread, freeing one anywhere else is
+ * not allowed, so they are kept apart from the images and only
+ * ever touched there. An image insert on a pool thread can then
+ * only evict images. Each gets half of the budget.
+ */
+struct EffectCacheData
+{
+    EffectCacheData() : images(4*1024*1024), pixmaps(4*1024*1024), clears(0)
+    {
+        for (int i = 0; i < EffectCache::Effects; ++i)
+            hits[i] = misses[i] = 0;
+    }
+    QMutex mutex;
+    QCache<EffectKey, QImage> images;
+    QCache<EffectKey, QPixmap> pixmaps;
+    quint64 hits[EffectCache::Effects], misses[EffectCache::Effects];
+    int clears;
+};
+
+static EffectCacheData &data()
+{
+    static EffectCacheData s_data;
+    return s_data;
+}
+
+static EffectKey key(const EffectCache::Effect effect, const qint64 source, const quint64 param, const quint64 extra)
+{
+    EffectKey k;
+    k.effect = effect;
+    k.source = source;
+    k.param = param;
+    k.extra = extra;
+    return k;
+}
+
+static bool isGuiThread()
+{
+    return QCoreApplication::instance() && QThread::currentThread() == QCoreApplication::instance()->thread();
+}
+
+/* a lower max cost trims from the least recently used end */
+template <typename T>
+static void trim(QCache<EffectKey, T> &cache, const int cost)
+{
+    const int budget = cache.maxCost();
+    cache.setMaxCost(qMax(0, cost));
+    cache.setMaxCost(budget);
+}
+
+bool
+EffectCache::find(const Effect effect, const qint64 source, const quint64 param, QPixmap &pix, const quint64 extra)
+{
+    EffectCacheData &d = data();
+    QMutexLocker lock(&d.mutex);
+    const QPixmap *p = isGuiThread() ? d.pixmaps.object(key(effect, source, param, extra)) : 0;
+    if (!p)
+    {
+        ++d.misses[effect];
+        return false;
+    }
+    ++d.hits[effect];
+    pix = *p;
+    return true;
+}
+
+bool
+EffectCache::find(const Effect effect, const qint64 source, const quint64 param, QImage &img, const quint64 extra)
+{
+    EffectCacheData &d = data();
+    QMutexLocker lock(&d.mutex);
+    const QImage *i = d.images.object(key(effect, source, param, extra));
+    if (!i)
+    {
+        ++d.misses[effect];
+        return false;
+    }
+    ++d.hits[effect];
+    img = *i;
+    return true;
+}
+
+void
+EffectCache::insert(const Effect effect, const qint64 source, const quint64 param, const QPixmap &pix, const quint64 extra)
+{
+    if (pix.isNull() || !isGuiThread())
+        return;
+    EffectCacheData &d = data();
+    QMutexLocker lock(&d.mutex);
+    d.pixmaps.insert(key(effect, source, param, extra), new QPixmap(pix), qMax(1, pix.width()*pix.height()*pix.depth()/8));
+}
+
+void
+EffectCache::insert(const Effect effect, const qint64 source, const quint64 param, const QImage &img, const quint64 extra)
+{
+    if (img.isNull())
+        return;
+    EffectCacheData &d = data();
+    QMutexLocker lock(&d.mutex);
+    d.images.insert(key(effect, source, param, extra), new QImage(img), qMax(1, img.bytesPerLine()*img.height()));
+}
+
+void
+EffectCache::clear()
+{
+    EffectCacheData &d = data();
+    QMutexLocker lock(&d.mutex);
+    d.images.clear();
+    //only the gui thread may let go of pixmaps, it is the one clearing
+    if (isGuiThread())
+        d.pixmaps.clear();
+    ++d.clears;
+}
+
+void
+EffectCache::setBudget(const int bytes)
+{
+    EffectCacheData &d = data();
+    QMutexLocker lock(&d.mutex);
+    d.images.setMaxCost(qMax(0, bytes/2));
+    d.pixmaps.setMaxCost(qMax(0, bytes-bytes/2));
+}
+
+qint64
+EffectCache::cost()
+{
+    EffectCacheData &d = data();
+    QMutexLocker lock(&d.mutex);
+    return qint64(d.images.totalCost()) + d.pixmaps.totalCost();
+}
+
+void
+EffectCache::shrink(const qint64 bytes)
+{
+    EffectCacheData &d = data();
+    QMutexLocker lock(&d.mutex);
+    //images first, what is left of bytes from the pixmaps
+    const qint64 fromImages = qMin<qint64>(bytes, d.images.totalCost());
+    trim(d.images, int(d.images.totalCost()-fromImages));
+    if (bytes > fromImages && isGuiThread())
+        trim(d.pixmaps, int(qMax<qint64>(0, d.pixmaps.totalCost()-(bytes-fromImages))));
+}
+
+QString
+EffectCache::statistics()
+{
+    static const char *names[Effects] = { "colorized", "stretched", "sunkenized" };
+    EffectCacheData &d = data();
+    QMutexLocker lock(&d.mutex);
+    QString stats = QString("%1 images %2 KiB of %3 KiB %4 pixmaps %5 KiB of %6 KiB clears %7\n")
+            .arg(d.images.count())
+            .arg(d.images.totalCost()/1024)
+            .arg(d.images.maxCost()/1024)
+            .arg(d.pixmaps.count())
+            .arg(d.pixmaps.totalCost()/1024)
+            .arg(d.pixmaps.maxCost()/1024)
+            .arg(d.clears);
+    for (int i = 0; i < Effects; ++i)
+    {
+        const quint64 total = d.hits[i]+d.misses[i];
+        stats += QString("%1 hits %2 misses %3 hit rate %4%\n")
+                .arg(names[i])
+                .arg(d.hits[i])
+                .arg(d.misses[i])
+                .arg(total ? 100.0*d.hits[i]/total : 0.0, 0, 'f', 1);
+    }
+    return stats;
+}
@@ -0,0 +1,34 @@
+#ifndef EFFECTCACHE_H
+#define EFFECTCACHE_H
+
+#include <QPixmap>
+#include <QImage>
+#include <QString>
+
+/* Results of the pure FX effects, keyed by the source cacheKey
+ * and whatever parameters the effect takes, packed into param and,
+ * when that is not enough room, extra, within a byte budget.
+ * Images may be looked up from any thread, pixmaps like always
+ * only on the gui thread, elsewhere they are never found nor kept.
+ * Cleared as a whole when the palette or the theme changes, and
+ * by the application before it goes, the pixmaps must not outlive
+ * it. gfx knows nothing of the application, the budget is set and
+ * the cache governed from outside.
+ */
+class Q_DECL_EXPORT EffectCache
+{
+public:
+    enum Effect { Colorized = 0, Stretched, Sunkenized, Effects };
+    static bool find(const Effect effect, const qint64 source, const quint64 param, QPixmap &pix, const quint64 extra = 0);
+    static bool find(const Effect effect, const qint64 source, const quint64 param, QImage &img, const quint64 extra = 0);
+    static void insert(const Effect effect, const qint64 source, const quint64 param, const QPixmap &pix, const quint64 extra = 0);
+    static void insert(const Effect effect, const qint64 source, const quint64 param, const QImage &img, const quint64 extra = 0);
+    static void clear();
+    static void setBudget(const int bytes);
+    static qint64 cost();
+    /* drops the least recently used entries worth about bytes */
+    static void shrink(const qint64 bytes);
+    static QString statistics();
+};
+
+#endif // EFFECTCACHE_H
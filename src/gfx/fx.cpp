@@ -1,11 +1,17 @@
 #include "fx.h"
 #include <math.h>
 #include "color.h"
+#include "cpu.h"
+#include "effectcache.h"
 #include <QImage>
 #include <QPixmap>
 #include <QPainter>
 #include <QSize>
 #include <QBrush>
+#include <QVector>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QDebug>
 
 /*
@@ -78,70 +84,500 @@ static inline void blurcol( QImage & im, int col, int alpha)
         blurinner<aprec,zprec>((unsigned char *)&ptr[index],zR,zG,zB,zA,alpha);
 }
 
+/* The same filter with all four channels of a pixel in 16 bit
+ * lanes, zprec 7 keeps the state within a short and the 16 bit
+ * alpha multiply is done as a high half multiply, so the result
+ * is bit exact with the scalar version above. Rows are done a
+ * few at a time side by side, columns in strips of neighbouring
+ * pixels so every access down the image is a contiguous load.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FX_X86
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static inline __m128i blurstep_sse2(const __m128i z, const __m128i p, const __m128i alpha, const __m128i fix)
+{
+    const __m128i d = _mm_sub_epi16(_mm_slli_epi16(p, 7), z);
+    //signed d times unsigned alpha, mulhi takes alpha as signed so add d back when it went negative
+    return _mm_add_epi16(z, _mm_add_epi16(_mm_mulhi_epi16(d, alpha), _mm_and_si128(d, fix)));
+}
+
+__attribute__((target("sse2")))
+static void blurrows_sse2(QImage &img, const int y0, const int y1, const int alpha)
+{
+    const __m128i a = _mm_set1_epi16(short(alpha)), fix = _mm_set1_epi16(alpha > 0x7fff ? -1 : 0), zero = _mm_setzero_si128();
+    const int w = img.width();
+    int y = y0;
+    for (; y+1 < y1; y += 2)
+    {
+        quint32 *r0 = reinterpret_cast<quint32 *>(img.scanLine(y)), *r1 = reinterpret_cast<quint32 *>(img.scanLine(y+1));
+#define LOAD2(x) _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(int(r0[x])), _mm_cvtsi32_si128(int(r1[x]))), zero)
+#define STORE2(x) { const __m128i p = _mm_packus_epi16(_mm_srli_epi16(z, 7), zero); r0[x] = _mm_cvtsi128_si32(p); r1[x] = _mm_cvtsi128_si32(_mm_srli_si128(p, 4)); }
+        __m128i z = _mm_slli_epi16(LOAD2(0), 7);
+        for (int x = 1; x < w; ++x)
+        {
+            z = blurstep_sse2(z, LOAD2(x), a, fix);
+            STORE2(x);
+        }
+        for (int x = w-2; x >= 0; --x)
+        {
+            z = blurstep_sse2(z, LOAD2(x), a, fix);
+            STORE2(x);
+        }
+#undef LOAD2
+#undef STORE2
+    }
+    for (; y < y1; ++y)
+        blurrow<16, 7>(img, y, alpha);
+}
+
+__attribute__((target("sse2")))
+static void blurcols_sse2(QImage &img, const int x0, const int x1, const int alpha)
+{
+    const __m128i a = _mm_set1_epi16(short(alpha)), fix = _mm_set1_epi16(alpha > 0x7fff ? -1 : 0), zero = _mm_setzero_si128();
+    const int h = img.height();
+    int x = x0;
+    for (; x+3 < x1; x += 4)
+    {
+#define PTR(y) reinterpret_cast<__m128i *>(reinterpret_cast<quint32 *>(img.scanLine(y))+x)
+        __m128i v = _mm_loadu_si128(PTR(0));
+        __m128i lo = _mm_slli_epi16(_mm_unpacklo_epi8(v, zero), 7), hi = _mm_slli_epi16(_mm_unpackhi_epi8(v, zero), 7);
+        //rows 1...h-2 going down, like blurcol the last row is left alone
+        for (int y = 1; y < h-1; ++y)
+        {
+            v = _mm_loadu_si128(PTR(y));
+            lo = blurstep_sse2(lo, _mm_unpacklo_epi8(v, zero), a, fix);
+            hi = blurstep_sse2(hi, _mm_unpackhi_epi8(v, zero), a, fix);
+            _mm_storeu_si128(PTR(y), _mm_packus_epi16(_mm_srli_epi16(lo, 7), _mm_srli_epi16(hi, 7)));
+        }
+        for (int y = h-2; y >= 0; --y)
+        {
+            v = _mm_loadu_si128(PTR(y));
+            lo = blurstep_sse2(lo, _mm_unpacklo_epi8(v, zero), a, fix);
+            hi = blurstep_sse2(hi, _mm_unpackhi_epi8(v, zero), a, fix);
+            _mm_storeu_si128(PTR(y), _mm_packus_epi16(_mm_srli_epi16(lo, 7), _mm_srli_epi16(hi, 7)));
+        }
+#undef PTR
+    }
+    for (; x < x1; ++x)
+        blurcol<16, 7>(img, x, alpha);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blurstep_avx2(const __m256i z, const __m256i p, const __m256i alpha, const __m256i fix)
+{
+    const __m256i d = _mm256_sub_epi16(_mm256_slli_epi16(p, 7), z);
+    return _mm256_add_epi16(z, _mm256_add_epi16(_mm256_mulhi_epi16(d, alpha), _mm256_and_si256(d, fix)));
+}
+
+__attribute__((target("avx2")))
+static void blurrows_avx2(QImage &img, const int y0, const int y1, const int alpha)
+{
+    const __m256i a = _mm256_set1_epi16(short(alpha)), fix = _mm256_set1_epi16(alpha > 0x7fff ? -1 : 0), zero = _mm256_setzero_si256();
+    const int w = img.width();
+    int y = y0;
+    for (; y+3 < y1; y += 4)
+    {
+        quint32 *r[4];
+        for (int i = 0; i < 4; ++i)
+            r[i] = reinterpret_cast<quint32 *>(img.scanLine(y+i));
+#define LOAD4(x) _mm256_cvtepu8_epi16(_mm_setr_epi32(int(r[0][x]), int(r[1][x]), int(r[2][x]), int(r[3][x])))
+#define STORE4(x) { const __m256i p = _mm256_packus_epi16(_mm256_srli_epi16(z, 7), zero); \
+            const __m128i l = _mm256_castsi256_si128(p), h = _mm256_extracti128_si256(p, 1); \
+            r[0][x] = _mm_cvtsi128_si32(l); r[1][x] = _mm_cvtsi128_si32(_mm_srli_si128(l, 4)); \
+            r[2][x] = _mm_cvtsi128_si32(h); r[3][x] = _mm_cvtsi128_si32(_mm_srli_si128(h, 4)); }
+        __m256i z = _mm256_slli_epi16(LOAD4(0), 7);
+        for (int x = 1; x < w; ++x)
+        {
+            z = blurstep_avx2(z, LOAD4(x), a, fix);
+            STORE4(x);
+        }
+        for (int x = w-2; x >= 0; --x)
+        {
+            z = blurstep_avx2(z, LOAD4(x), a, fix);
+            STORE4(x);
+        }
+#undef LOAD4
+#undef STORE4
+    }
+    blurrows_sse2(img, y, y1, alpha);
+}
+
+__attribute__((target("avx2")))
+static void blurcols_avx2(QImage &img, const int x0, const int x1, const int alpha)
+{
+    const __m256i a = _mm256_set1_epi16(short(alpha)), fix = _mm256_set1_epi16(alpha > 0x7fff ? -1 : 0), zero = _mm256_setzero_si256();
+    const int h = img.height();
+    int x = x0;
+    for (; x+7 < x1; x += 8)
+    {
+#define PTR(y) reinterpret_cast<__m256i *>(reinterpret_cast<quint32 *>(img.scanLine(y))+x)
+        //unpack and pack both work within 128 bit lanes, so the pixel order survives the round trip
+        __m256i v = _mm256_loadu_si256(PTR(0));
+        __m256i lo = _mm256_slli_epi16(_mm256_unpacklo_epi8(v, zero), 7), hi = _mm256_slli_epi16(_mm256_unpackhi_epi8(v, zero), 7);
+        for (int y = 1; y < h-1; ++y)
+        {
+            v = _mm256_loadu_si256(PTR(y));
+            lo = blurstep_avx2(lo, _mm256_unpacklo_epi8(v, zero), a, fix);
+            hi = blurstep_avx2(hi, _mm256_unpackhi_epi8(v, zero), a, fix);
+            _mm256_storeu_si256(PTR(y), _mm256_packus_epi16(_mm256_srli_epi16(lo, 7), _mm256_srli_epi16(hi, 7)));
+        }
+        for (int y = h-2; y >= 0; --y)
+        {
+            v = _mm256_loadu_si256(PTR(y));
+            lo = blurstep_avx2(lo, _mm256_unpacklo_epi8(v, zero), a, fix);
+            hi = blurstep_avx2(hi, _mm256_unpackhi_epi8(v, zero), a, fix);
+            _mm256_storeu_si256(PTR(y), _mm256_packus_epi16(_mm256_srli_epi16(lo, 7), _mm256_srli_epi16(hi, 7)));
+        }
+#undef PTR
+    }
+    blurcols_sse2(img, x, x1, alpha);
+}
+#endif
+
+static void blurrows_scalar(QImage &img, const int y0, const int y1, const int alpha)
+{
+    for (int y = y0; y < y1; ++y)
+        blurrow<16, 7>(img, y, alpha);
+}
+
+static void blurcols_scalar(QImage &img, const int x0, const int x1, const int alpha)
+{
+    for (int x = x0; x < x1; ++x)
+        blurcol<16, 7>(img, x, alpha);
+}
+
 void
 FX::expblur(QImage &img, int radius, Qt::Orientations o)
 {
-    if(radius<1)
+    if(radius<1 || img.isNull() || img.depth() != 32)
         return;
 
-    static const int aprec = 16; static const int zprec = 7;
+    static const int aprec = 16;
 
     // Calculate the alpha such that 90% of the kernel is within the radius. (Kernel extends to infinity)
-    int alpha = (int)((1<<aprec)*(1.0f-expf(-2.3f/(radius+1.f))));
+    const int alpha = (int)((1<<aprec)*(1.0f-expf(-2.3f/(radius+1.f))));
+
+    typedef void (*Pass)(QImage &, const int, const int, const int);
+    Pass rows(blurrows_scalar), cols(blurcols_scalar);
+#if defined(FX_X86)
+    switch (CPU::level())
+    {
+    case CPU::AVX2: rows = blurrows_avx2; cols = blurcols_avx2; break;
+    case CPU::SSE2: rows = blurrows_sse2; cols = blurcols_sse2; break;
+    default: break;
+    }
+#endif
+    //scanLine() detaches, that must not happen on several threads at once
+    img.detach();
+    //small images are not worth waking up threads for
+    const bool split = img.width()*img.height() >= 256*256;
+    if (o & Qt::Horizontal)
+    {
+        if (split)
+            CPU::parallel(img.height(), 4, [&](int begin, int end) { rows(img, begin, end, alpha); });
+        else
+            rows(img, 0, img.height(), alpha);
+    }
+    if (o & Qt::Vertical)
+    {
+        if (split)
+            CPU::parallel(img.width(), 8, [&](int begin, int end) { cols(img, begin, end, alpha); });
+        else
+            cols(img, 0, img.width(), alpha);
+    }
+}
+
+/*
+// Triple box blur ==================================================
+*  boxblur(QImage &img, int radius)
+*
+*  Three box filters in a row converge on a gaussian, each is a
+*  sliding window sum so the cost per pixel does not depend on the
+*  radius. The box sizes follow the usual n = 3 derivation for a
+*  given sigma, sigma is picked so that 90% of the kernel is within
+*  the radius like for expblur. Edges are extended, sums are 32 bit
+*  per channel and scaled back to 8 bit after every box in float,
+*  the same operations on the scalar and the SSE2 path so both give
+*  the same result.
+*/
+
+enum { BoxStrip = 16 }; //adjacent columns blurred side by side, a cache line of pixels
 
-    if (o & Qt::Horizontal) {
-        for(int row=0;row<img.height();row++)
-            blurrow<aprec,zprec>(img,row,alpha);
+static void boxradii(const float sigma, int r[3])
+{
+    const float ideal = sqrtf(12.0f*sigma*sigma/3.0f + 1.0f);
+    int wl = int(ideal);
+    if (!(wl & 1))
+        --wl;
+    const int m = qRound((12.0f*sigma*sigma - 3.0f*wl*wl - 12.0f*wl - 9.0f)/(-4.0f*wl - 4.0f));
+    for (int i = 0; i < 3; ++i)
+        r[i] = ((i < m ? wl : wl+2) - 1)/2;
+}
+
+/* the window around the first pixel, the edge repeated r+1 times on the left */
+static void boxinit(const quint32 *src, const int ss, const int n, const int r, int sum[4])
+{
+    const int inside = qMin(r, n-1);
+    for (int c = 0; c < 4; ++c)
+    {
+        int s = (r+1)*((src[0] >> (c*8)) & 0xff) + (r-inside)*((src[(n-1)*ss] >> (c*8)) & 0xff);
+        for (int i = 1; i <= inside; ++i)
+            s += (src[i*ss] >> (c*8)) & 0xff;
+        sum[c] = s;
     }
+}
 
-    if (o & Qt::Vertical) {
-        for(int col=0;col<img.width();col++)
-            blurcol<aprec,zprec>(img,col,alpha);
+/* One box of radius r over n pixels, lanes neighbouring pixels at a
+ * time, src and dst advance ss and ds pixels from one step to the next.
+ */
+static void boxpass_scalar(quint32 *dst, const int ds, const quint32 *src, const int ss, const int n, const int lanes, const int r)
+{
+    const float inv = 1.0f/(2*r+1);
+    for (int l = 0; l < lanes; ++l)
+    {
+        int sum[4];
+        boxinit(src+l, ss, n, r, sum);
+        for (int i = 0; i < n; ++i)
+        {
+            const quint32 in = src[qMin(i+r+1, n-1)*ss+l], out = src[qMax(i-r, 0)*ss+l];
+            quint32 px(0);
+            for (int c = 0; c < 4; ++c)
+            {
+                px |= quint32(int(float(sum[c])*inv + 0.5f)) << (c*8);
+                sum[c] += int((in >> (c*8)) & 0xff) - int((out >> (c*8)) & 0xff);
+            }
+            dst[i*ds+l] = px;
+        }
     }
 }
 
-QPixmap
-FX::mid(const QPixmap &p1, const QPixmap &p2, const int a1, const int a2, const QSize &sz)
+#if defined(FX_X86)
+__attribute__((target("sse2")))
+static inline __m128i boxexpand_sse2(const quint32 px)
+{
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(int(px)), zero), zero);
+}
+
+/* the four channel sums of a pixel in one register */
+__attribute__((target("sse2")))
+static void boxpass_sse2(quint32 *dst, const int ds, const quint32 *src, const int ss, const int n, const int lanes, const int r)
+{
+    __m128i sum[BoxStrip];
+    for (int l = 0; l < lanes; ++l)
+    {
+        int s[4];
+        boxinit(src+l, ss, n, r, s);
+        sum[l] = _mm_setr_epi32(s[0], s[1], s[2], s[3]);
+    }
+    const __m128 inv = _mm_set1_ps(1.0f/(2*r+1)), half = _mm_set1_ps(0.5f);
+    for (int i = 0; i < n; ++i)
+    {
+        const quint32 *in = src + qMin(i+r+1, n-1)*ss, *out = src + qMax(i-r, 0)*ss;
+        quint32 *d = dst + i*ds;
+        for (int l = 0; l < lanes; ++l)
+        {
+            const __m128i v = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum[l]), inv), half));
+            const __m128i w = _mm_packs_epi32(v, v);
+            d[l] = quint32(_mm_cvtsi128_si32(_mm_packus_epi16(w, w)));
+            sum[l] = _mm_add_epi32(sum[l], _mm_sub_epi32(boxexpand_sse2(in[l]), boxexpand_sse2(out[l])));
+        }
+    }
+}
+#endif
+
+void
+FX::boxblur(QImage &img, int radius, Qt::Orientations o)
+{
+    if (radius < 1 || img.isNull() || img.depth() != 32)
+        return;
+
+    int r[3];
+    boxradii(radius/1.645f, r);
+
+    typedef void (*Pass)(quint32 *, const int, const quint32 *, const int, const int, const int, const int);
+    Pass pass(boxpass_scalar);
+#if defined(FX_X86)
+    if (CPU::level() >= CPU::SSE2)
+        pass = boxpass_sse2;
+#endif
+    const int w = img.width(), h = img.height(), bpl = img.bytesPerLine()/4;
+    //bits() detaches, that must not happen on several threads at once
+    quint32 *bits = reinterpret_cast<quint32 *>(img.bits());
+    const bool split = w*h >= 256*256;
+    if (o & Qt::Horizontal)
+    {
+        const auto rows = [&](int begin, int end)
+        {
+            QVector<quint32> a(w), b(w);
+            for (int y = begin; y < end; ++y)
+            {
+                quint32 *line = bits + y*bpl;
+                pass(b.data(), 1, line, 1, w, 1, r[0]);
+                pass(a.data(), 1, b.data(), 1, w, 1, r[1]);
+                pass(line, 1, a.data(), 1, w, 1, r[2]);
+            }
+        };
+        if (split)
+            CPU::parallel(h, 4, rows);
+        else
+            rows(0, h);
+    }
+    if (o & Qt::Vertical)
+    {
+        //strips of columns go through contiguous buffers, one cache line per row read
+        const auto cols = [&](int begin, int end)
+        {
+            QVector<quint32> a(h*BoxStrip), b(h*BoxStrip);
+            for (int x = begin; x < end; x += BoxStrip)
+            {
+                const int lanes = qMin(int(BoxStrip), end-x);
+                quint32 *col = bits + x;
+                pass(b.data(), BoxStrip, col, bpl, h, lanes, r[0]);
+                pass(a.data(), BoxStrip, b.data(), BoxStrip, h, lanes, r[1]);
+                pass(col, bpl, a.data(), BoxStrip, h, lanes, r[2]);
+            }
+        };
+        if (split)
+            CPU::parallel(w, BoxStrip, cols);
+        else
+            cols(0, w);
+    }
+}
+
+void
+FX::blur(QImage &img, int radius, Qt::Orientations o)
+{
+    //the recurrence of expblur is cheaper for small radii, it loses
+    //precision and drifts from a gaussian the wider it gets
+    if (radius < BoxBlurFrom)
+        expblur(img, radius, o);
+    else
+        boxblur(img, radius, o);
+}
+
+/* Weighted mean of two scanlines, per channel on straight (not
+ * premultiplied) argb, exactly what Color::mid does per pixel:
+ * (w1*c1 + w2*c2)/(w1+w2) truncated.
+ */
+static void midline_scalar(quint32 *d, const quint32 *s, const int n, const int w1, const int w2)
+{
+    const int w3 = w1+w2;
+    for (int i = 0; i < n; ++i)
+    {
+        quint32 out(0);
+        for (int shift = 0; shift < 32; shift += 8)
+            out |= quint32(qBound(0, (w1*int((d[i] >> shift) & 0xff) + w2*int((s[i] >> shift) & 0xff))/w3, 255)) << shift;
+        d[i] = out;
+    }
+}
+
+#if defined(FX_X86)
+__attribute__((target("sse2")))
+static void midline_sse2(quint32 *d, const quint32 *s, const int n, const int w1, const int w2)
+{
+    int i(0);
+    if (w1 == w2)
+    {
+        //floor((a+b)/2) per byte, avg rounds up so take the odd bit back off
+        const __m128i one = _mm_set1_epi8(1);
+        for (; i+3 < n; i += 4)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(d+i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s+i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d+i), _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one)));
+        }
+    }
+    else
+    {
+        //w1+w2 <= 257 keeps the sums in 16 bits, the division is a float
+        //multiply that is exact there: (n+0.5)/w3 is never within reach
+        //of an integer boundary for n < 65536
+        const __m128i zero = _mm_setzero_si128(), W1 = _mm_set1_epi16(short(w1)), W2 = _mm_set1_epi16(short(w2));
+        const __m128 inv = _mm_set1_ps(1.0f/(w1+w2)), half = _mm_set1_ps(0.5f);
+#define DIV(v) _mm_cvttps_epi32(_mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(v), half), inv))
+        for (; i+3 < n; i += 4)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(d+i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s+i));
+            const __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), W1), _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), W2));
+            const __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), W1), _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), W2));
+            const __m128i qlo = _mm_packs_epi32(DIV(_mm_unpacklo_epi16(lo, zero)), DIV(_mm_unpackhi_epi16(lo, zero)));
+            const __m128i qhi = _mm_packs_epi32(DIV(_mm_unpacklo_epi16(hi, zero)), DIV(_mm_unpackhi_epi16(hi, zero)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d+i), _mm_packus_epi16(qlo, qhi));
+        }
+#undef DIV
+    }
+    midline_scalar(d+i, s+i, n-i, w1, w2);
+}
+#endif
+
+void
+FX::blend(QImage &img, const QImage &other, const int a1, const int a2)
+{
+    if (img.isNull() || other.isNull() || a1+a2 <= 0
+            || img.format() != QImage::Format_ARGB32
+            || other.format() != QImage::Format_ARGB32)
+        return;
+
+    typedef void (*Line)(quint32 *, const quint32 *, const int, const int, const int);
+    Line line(midline_scalar);
+#if defined(FX_X86)
+    if (CPU::level() >= CPU::SSE2 && a1 >= 0 && a2 >= 0 && a1+a2 <= 257)
+        line = midline_sse2;
+#endif
+    const int w(qMin(img.width(), other.width())), h(qMin(img.height(), other.height()));
+    for (int y = 0; y < h; ++y)
+        line(reinterpret_cast<quint32 *>(img.scanLine(y)), reinterpret_cast<const quint32 *>(other.constScanLine(y)), w, a1, a2);
+}
+
+QImage
+FX::mid(const QImage &i1, const QImage &i2, const int a1, const int a2, const QSize &sz)
 {
-    int w(qMin(p1.width(), p2.width()));
-    int h(qMin(p1.height(), p2.height()));
+    int w(qMin(i1.width(), i2.width()));
+    int h(qMin(i1.height(), i2.height()));
     if (sz.isValid())
     {
         w = sz.width();
         h = sz.height();
     }
-    QImage i1 = p1.copy(0, 0, w, h).toImage().convertToFormat(QImage::Format_ARGB32);
-    QImage i2 = p2.copy(0, 0, w, h).toImage().convertToFormat(QImage::Format_ARGB32);
-    const int size(w*h);
-    QImage i3(w, h, QImage::Format_ARGB32); //the resulting image
-    i3.fill(Qt::transparent);
-    QRgb *rgb1 = reinterpret_cast<QRgb *>(i1.bits());
-    QRgb *rgb2 = reinterpret_cast<QRgb *>(i2.bits());
-    QRgb *rgb3 = reinterpret_cast<QRgb *>(i3.bits());
+    //copy() fills what is outside the source with transparency
+    QImage img(i1.convertToFormat(QImage::Format_ARGB32));
+    if (img.size() != QSize(w, h))
+        img = img.copy(0, 0, w, h);
+    QImage other(i2.convertToFormat(QImage::Format_ARGB32));
+    if (other.size() != QSize(w, h))
+        other = other.copy(0, 0, w, h);
+    blend(img, other, a1, a2);
+    return img;
+}
 
-    for (int i = 0; i < size; ++i)
-        rgb3[i] = Color::mid(QColor::fromRgba(rgb1[i]), QColor::fromRgba(rgb2[i]), a1, a2).rgba();
-    return QPixmap::fromImage(i3);
+QPixmap
+FX::mid(const QPixmap &p1, const QPixmap &p2, const int a1, const int a2, const QSize &sz)
+{
+    return QPixmap::fromImage(mid(p1.toImage(), p2.toImage(), a1, a2, sz));
 }
 
 QPixmap
 FX::mid(const QPixmap &p1, const QBrush &b, const int a1, const int a2, const QSize &sz)
 {
-    QPixmap pix1;
+    QImage i1(p1.toImage());
     if (sz.width() > p1.width() || sz.height() > p1.height())
     {
-        pix1 = QPixmap(sz);
-        pix1.fill(Qt::transparent);
-        QPainter p(&pix1);
-        p.drawTiledPixmap(pix1.rect(), p1);
+        i1 = QImage(sz, QImage::Format_ARGB32_Premultiplied);
+        i1.fill(Qt::transparent);
+        QPainter p(&i1);
+        p.drawTiledPixmap(i1.rect(), p1);
         p.end();
     }
-    QPixmap p2(sz.isValid()?sz:p1.size());
-    p2.fill(Qt::transparent);
-    QPainter p(&p2);
-    p.fillRect(p2.rect(), b);
+    QImage i2(sz.isValid()?sz:p1.size(), QImage::Format_ARGB32_Premultiplied);
+    i2.fill(Qt::transparent);
+    QPainter p(&i2);
+    p.fillRect(i2.rect(), b);
     p.end();
-    return mid(pix1.isNull()?p1:pix1, p2, a1, a2, sz);
+    return QPixmap::fromImage(mid(i1, i2, a1, a2, sz));
 }
 
 //colortoalpha directly stolen from gimp
@@ -207,64 +643,154 @@ FX::colortoalpha (float *a1,
   *a4 *= alpha4/255.0;
 }
 
+/* the exponential blur recurrence from above on a single plane
+ * of ints that are already shifted up by zprec
+ */
+static void blurplane(int *plane, const int w, const int h, const int radius)
+{
+    const int alpha = (int)((1<<16)*(1.0f-expf(-2.3f/(radius+1.f))));
+#define STEP(i) { z += (alpha * (plane[i]-z))>>16; plane[i] = z; }
+    for (int y = 0; y < h; ++y)
+    {
+        int z = plane[y*w];
+        for (int x = 1; x < w; ++x)
+            STEP(y*w+x);
+        for (int x = w-2; x >= 0; --x)
+            STEP(y*w+x);
+    }
+    for (int x = 0; x < w; ++x)
+    {
+        int z = plane[x];
+        for (int y = 1; y < h-1; ++y)
+            STEP(y*w+x);
+        for (int y = h-2; y >= 0; --y)
+            STEP(y*w+x);
+    }
+#undef STEP
+}
+
+/* Inset look for text and icons, the source gets a blurred dark
+ * shadow overlaid along its upper inner edge (light mode only) and
+ * a one pixel highlight under its lower edges. All of it is worked
+ * out per pixel in one pass over the source, after a blur of a
+ * single alpha plane. Results are remembered in the EffectCache.
+ */
 QPixmap
 FX::sunkenized(const QRect &r, const QPixmap &source, const bool isDark, const int shadowOpacity)
 {
-    int m(4);
-    QImage img(r.size()+QSize(m, m), QImage::Format_ARGB32);
-    m/=2;
-    img.fill(Qt::transparent);
-    QPainter p(&img);
-    int rgb(isDark?255:0);
-    int alpha(/*qMin(*/shadowOpacity/*, 2*dConf.shadows.opacity)*/);
-    p.fillRect(img.rect(), QColor(rgb, rgb, rgb, alpha));
-    p.setCompositionMode(QPainter::CompositionMode_DestinationOut);
-    p.drawTiledPixmap(r.translated(m, m), source);
-    p.end();
-    QImage blur(img);
-    FX::expblur(blur, m);
-    QPixmap highlight(r.size());
-    highlight.fill(Qt::transparent);
-    p.begin(&highlight);
-    rgb = isDark?0:255;
-    p.fillRect(highlight.rect(), QColor(rgb, rgb, rgb, alpha));
-    p.setCompositionMode(QPainter::CompositionMode_DestinationIn);
-    p.drawTiledPixmap(highlight.rect(), source);
-    p.setCompositionMode(QPainter::CompositionMode_DestinationOut);
-    p.drawTiledPixmap(highlight.rect().translated(0, -1), source);
-    p.end();
+    if (r.isEmpty() || source.isNull())
+        return QPixmap();
 
-    QPixmap pix(r.size());
-    pix.fill(Qt::transparent);
-    p.begin(&pix);
-    p.drawTiledPixmap(pix.rect(), source);
+    //the shadow is cut out where the source is drawn over r, so
+    //r away from the origin moves it against the source
+    const quint64 param = (quint64(r.width()) << 40) | (quint64(r.height()) << 16) | (quint64(qBound(0, shadowOpacity, 255)) << 1) | isDark;
+    const quint64 offset = (quint64(quint32(r.x())) << 32) | quint32(r.y());
+    QPixmap pix;
+    if (EffectCache::find(EffectCache::Sunkenized, source.cacheKey(), param, pix, offset))
+        return pix;
+
+    const QImage src = source.toImage().convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    const QRgb *sp = reinterpret_cast<const QRgb *>(src.constBits());
+    const int sw(src.width()), sh(src.height()), sbpl(src.bytesPerLine()/4);
+    const int w(r.width()), h(r.height()), m(2), pw(w+m*2), ph(h+m*2);
+    const float alpha(qBound(0, shadowOpacity, 255)/255.0f);
+    //the source is tiled over r
+#define SRCA(x, y) (qAlpha(sp[((y)%sh)*sbpl + (x)%sw])/255.0f)
+
+    //the shadow, the inverted source mask on a padded plane, blurred
+    QVector<int> shadow;
     if (!isDark)
     {
-        p.setCompositionMode(QPainter::CompositionMode_Overlay);
-        p.drawTiledPixmap(pix.rect().translated(0, 1), QPixmap::fromImage(blur), QPoint(m, m));
+        shadow.resize(pw*ph);
+        const int ox(m+r.x()), oy(m+r.y());
+        for (int y = 0; y < ph; ++y)
+            for (int x = 0; x < pw; ++x)
+            {
+                const bool inside(x >= ox && x < ox+w && y >= oy && y < oy+h);
+                const int a(qRound(alpha*255.0f*(1.0f-(inside ? SRCA(x-ox, y-oy) : 0.0f))));
+                shadow[y*pw+x] = a<<7;
+            }
+        blurplane(shadow.data(), pw, ph, m);
     }
-    p.setCompositionMode(QPainter::CompositionMode_DestinationIn);
-    p.drawTiledPixmap(pix.rect(), source);
-    p.setCompositionMode(QPainter::CompositionMode_DestinationOver);
-    p.drawTiledPixmap(pix.rect().translated(0, 1), highlight);
-    p.end();
+
+    QImage img(w, h, QImage::Format_ARGB32_Premultiplied);
+    const float hl(isDark ? 0.0f : 1.0f); //highlight color
+    for (int y = 0; y < h; ++y)
+    {
+        QRgb *out = reinterpret_cast<QRgb *>(img.scanLine(y));
+        for (int x = 0; x < w; ++x)
+        {
+            const QRgb s(sp[(y%sh)*sbpl + x%sw]);
+            const float sa(qAlpha(s)/255.0f);
+            float c[3] = { qRed(s)/255.0f, qGreen(s)/255.0f, qBlue(s)/255.0f }, da(sa);
+            if (y && !isDark)
+            {
+                //black shadow overlaid, one pixel down
+                const float b((shadow[(y+1)*pw+x+m]>>7)/255.0f);
+                for (int i = 0; i < 3; ++i)
+                    c[i] = 2.0f*c[i] < da ? c[i]*(1.0f-b) : b*(2.0f*c[i]-da) + c[i]*(1.0f-b);
+                da = b + da - b*da;
+            }
+            //clipped to the source
+            for (int i = 0; i < 3; ++i)
+                c[i] *= sa;
+            da *= sa;
+            if (y)
+            {
+                //highlight under, where the source ends going down
+                const float ha(alpha*SRCA(x, y-1)*(1.0f-sa));
+                for (int i = 0; i < 3; ++i)
+                    c[i] += hl*ha*(1.0f-da);
+                da += ha*(1.0f-da);
+            }
+            out[x] = qRgba(qRound(qMin(c[0], da)*255.0f), qRound(qMin(c[1], da)*255.0f), qRound(qMin(c[2], da)*255.0f), qRound(da*255.0f));
+        }
+    }
+#undef SRCA
+
+    pix = QPixmap::fromImage(img);
+    EffectCache::insert(EffectCache::Sunkenized, source.cacheKey(), param, pix, offset);
     return pix;
 }
 
-int
-FX::stretch(const int v, const float n)
+/* built once per exponent, function statics are thread safe to
+ * initialize so this is fine from the thumbnail and icon workers
+ */
+struct StretchTable
 {
-    static bool isInit(false);
-    static float table[256];
-    if (!isInit)
+    explicit StretchTable(const float n)
     {
+        float table[256];
         for (int i = 127; i < 256; ++i)
             table[i] = (pow(((float)i/127.5f-1.0f), (1.0f/n))+1.0f)*127.5f;
         for (int i = 0; i < 128; ++i)
             table[i] = 255-table[255-i];
-        isInit = true;
+        for (int i = 0; i < 256; ++i)
+            values[i] = qRound(table[i]);
+    }
+    quint8 values[256];
+};
+
+int
+FX::stretch(const int v, const float n)
+{
+    static const StretchTable s_default(1.5f), s_alpha(2.0f);
+    const int i(qBound(0, v, 255));
+    if (n == 1.5f)
+        return s_default.values[i];
+    if (n == 2.0f)
+        return s_alpha.values[i];
+    //any other exponent gets its table built once too, there are only ever a few
+    static QMutex s_mutex;
+    static QHash<float, StretchTable *> s_tables;
+    QMutexLocker lock(&s_mutex);
+    StretchTable *table = s_tables.value(n);
+    if (!table)
+    {
+        table = new StretchTable(n);
+        s_tables.insert(n, table);
     }
-    return qRound(table[v]);
+    return table->values[i];
 }
 
 /**
@@ -289,9 +815,18 @@ FX::stretch(const int v, const float n)
 int
 FX::pushed(const float v, const float inlo, const float inup, const float outlo, const float outup)
 {
+    if (inup == inlo)
+        return qRound(v);
     return qRound((v - inlo) * ((outup-outlo)/(inup-inlo)) + outlo);
 }
 
+void
+FX::pushedTable(quint8 *lut, const int inlo, const int inup, const int outlo, const int outup)
+{
+    for (int i = 0; i < 256; ++i)
+        lut[i] = qBound(0, pushed(i, inlo, inup, outlo, outup), 255);
+}
+
 QImage
 FX::stretched(QImage img)
 {
@@ -306,35 +841,56 @@ FX::stretched(QImage img)
     return image;
 }
 
-QImage
-FX::stretched(QImage img, const QColor &c)
+/* Color::lum without going through QColor */
+static inline int lum(const QRgb rgb)
+{
+    return (qRed(rgb)*299 + qGreen(rgb)*587 + qBlue(rgb)*114)/1000;
+}
+
+static QImage
+stretchedColored(QImage img, const QColor &c)
 {
     img = img.convertToFormat(QImage::Format_ARGB32);
-    int size = img.width() * img.height();
+    const int size = img.width() * img.height();
     QRgb *pixels[2] = { 0, 0 };
     pixels[0] = reinterpret_cast<QRgb *>(img.bits());
     int r, g, b;
     c.getRgb(&r, &g, &b); //foregroundcolor
 
 #define ENSUREALPHA if (!qAlpha(pixels[0][i])) continue
-    QList<int> hues;
-    for (int i = 0; i < size; ++i)
+    /* we only need to know if there is more then one hue, a fixed
+     * table of seen hues and bailing at the second one does it,
+     * and neighbouring pixels mostly share a color so the QColor
+     * hue math only runs when the color changes.
+     */
+    bool seen[361] = { false };
+    int hues(0);
+    QRgb lastRgb(0);
+    int lastHue(-2);
+    for (int i = 0; i < size && hues < 2; ++i)
     {
         ENSUREALPHA;
-        const int hue = QColor::fromRgba(pixels[0][i]).hue();
-        if (!hues.contains(hue))
-            hues << hue;
+        const QRgb rgb(pixels[0][i] | 0xff000000);
+        if (rgb != lastRgb || lastHue == -2)
+        {
+            lastRgb = rgb;
+            lastHue = QColor::fromRgba(rgb).hue();
+        }
+        if (!seen[lastHue+1])
+        {
+            seen[lastHue+1] = true;
+            ++hues;
+        }
     }
 
-    const bool useAlpha(hues.count() == 1);
+    const bool useAlpha(hues == 1);
     if (useAlpha)
     {
         int l(0), h(0);
         for (int i = 0; i < size; ++i)
         {
             ENSUREALPHA;
-            const QColor c = QColor::fromRgba(pixels[0][i]);
-            if (Color::lum(c) < 128)
+            if (lum(pixels[0][i]) < 128)
                 ++l;
             else
                 ++h;
@@ -350,7 +906,8 @@ FX::stretched(QImage img, const QColor &c)
           * push all remaining alpha values so the
           * highest one is 255.
           */
-        float alpha[size], lowAlpha(255), highAlpha(0);
+        QVector<float> alpha(size); //heap, icons at high dpi do not fit on the stack
+        float lowAlpha(255), highAlpha(0);
         for (int i = 0; i < size; ++i)
         {
             ENSUREALPHA;
@@ -364,11 +921,15 @@ FX::stretched(QImage img, const QColor &c)
                 highAlpha = a;
             alpha[i] = a;
         }
-        float add(255.0f/highAlpha);
+        quint8 lut[256];
+        for (int i = 0; i < 256; ++i)
+            lut[i] = stretch(i, 2.0f);
+        //nothing left after taking the color out, nothing to push up either
+        const float add(highAlpha > 0.0f ? 255.0f/highAlpha : 0.0f);
         for (int i = 0; i < size; ++i)
         {
             ENSUREALPHA;
-            pixels[0][i] = qRgba(r, g, b, stretch(qMin<int>(255, alpha[i]*add), 2.0f));
+            pixels[0][i] = qRgba(r, g, b, lut[qBound<int>(0, alpha[i]*add, 255)]);
         }
         return img;
     }
@@ -378,27 +939,27 @@ FX::stretched(QImage img, const QColor &c)
     bg.fill(Qt::transparent);
 
     QPainter bp(&bg);
-    bp.drawPixmap(br, br, QPixmap::fromImage(img), 0, 0, img.width(), img.height());
+    bp.drawImage(br, br, img);
     bp.end();
-    FX::expblur(bg, br);
+    FX::blur(bg, br);
     bg = bg.copy(bg.rect().adjusted(br, br, -br, -br)); //remove padding so we can easily access relevant pixels with [i]
 
-    enum Rgba { Red = 0, Green, Blue, Alpha };
     enum ImageType { Fg = 0, Bg }; //fg is the actual image, bg is the blurred one we use as reference for the most contrasting channel
 
     pixels[1] = reinterpret_cast<QRgb *>(bg.bits());
     double rgbCount[3] = { 0.0d, 0.0d, 0.0d };
-    int (*rgba[4])(QRgb rgb) = { qRed, qGreen, qBlue, qAlpha };
-    int cVal[2][4] = {{ 0, 0, 0, 0 }, {0, 0, 0, 0}};
+    static const int shifts[3] = { 16, 8, 0 }; //red, green, blue
 
     for (int i = 0; i < size; ++i) //pass 1, determine most contrasting channel, usually RED
-    for (int it = 0; it < 2; ++it)
-    for (int d = 0; d < 4; ++d)
     {
         ENSUREALPHA;
-        cVal[it][d] = (*rgba[d])(pixels[it][i]);
-        if (it && d < 3)
-            rgbCount[d] += (cVal[Fg][Alpha]+cVal[Bg][Alpha]) * qAbs(cVal[Fg][d]-cVal[Bg][d]) / (2.0f * cVal[Bg][d]);
+        const QRgb fg(pixels[Fg][i]), bgPx(pixels[Bg][i]);
+        const int alphas(qAlpha(fg)+qAlpha(bgPx));
+        for (int d = 0; d < 3; ++d)
+        {
+            const int f((fg >> shifts[d]) & 0xff), v((bgPx >> shifts[d]) & 0xff);
+            rgbCount[d] += alphas * qAbs(f-v) / (2.0f * v);
+        }
     }
     double count = 0;
     int channel = 0;
@@ -408,14 +969,13 @@ FX::stretched(QImage img, const QColor &c)
             channel = i;
             count = rgbCount[i];
         }
-    float values[size];
-    float inLo = 255.0f, inHi = 0.0f;
+    const int shift(shifts[channel]);
+    int inLo = 255, inHi = 0;
     qulonglong loCount(0), hiCount(0);
-    for ( int i = 0; i < size; ++i ) //pass 2, store darkest/lightest pixels
+    for ( int i = 0; i < size; ++i ) //pass 2, find darkest/lightest pixels
     {
         ENSUREALPHA;
-        const float px((*rgba[channel])(pixels[Fg][i]));
-        values[i] = px;
+        const int px((pixels[Fg][i] >> shift) & 0xff);
         if ( px > inHi )
             inHi = px;
         if ( px < inLo )
@@ -427,18 +987,40 @@ FX::stretched(QImage img, const QColor &c)
             hiCount += a*px;
     }
     const bool isDark(loCount>hiCount);
-    for ( int i = 0; i < size; ++i )
+    //the channel only has 256 possible values, so has the levels stretch.
+    //a flat (or fully transparent) channel has nothing to stretch, it is kept as is
+    quint8 levels[256], lut[256];
+    const float scale(inHi > inLo ? 255.0f/(inHi-inLo) : 0.0f);
+    for (int i = 0; i < 256; ++i)
+    {
+        levels[i] = inHi > inLo ? qBound<int>(0, qRound((float(i) - inLo) * scale), 255) : i;
+        lut[i] = stretch(i);
+    }
+    for ( int i = 0; i < size; ++i ) //pass 3, the channel becomes the alpha
     {
         ENSUREALPHA;
-        int a(qBound<int>(0, qRound((values[i] - inLo) * (255.0f / (inHi - inLo))), 255));
+        int a(levels[(pixels[Fg][i] >> shift) & 0xff]);
         if (isDark)
             a = qMax(0, qAlpha(pixels[Fg][i])-a);
-        pixels[Fg][i] = qRgba(r, g, b, stretch(a));
+        pixels[Fg][i] = qRgba(r, g, b, lut[a]);
     }
 #undef ENSUREALPHA
     return img;
 }
 
+QImage
+FX::stretched(QImage img, const QColor &c)
+{
+    const qint64 source(img.cacheKey());
+    const quint64 param(c.rgba());
+    QImage result;
+    if (EffectCache::find(EffectCache::Stretched, source, param, result))
+        return result;
+    result = stretchedColored(img, c);
+    EffectCache::insert(EffectCache::Stretched, source, param, result);
+    return result;
+}
+
 //QPixmap
 //FX::monochromized(const QPixmap &source, const QColor &color, const Effect effect, bool isDark)
 //{
@@ -451,6 +1033,12 @@ FX::stretched(QImage img, const QColor &c)
 void
 FX::colorizePixmap(QPixmap &pix, const QBrush &b)
 {
+    //gradients and textures do not make a key, plain colors do
+    const bool cacheable(b.style() == Qt::SolidPattern && !pix.isNull());
+    const qint64 source(pix.cacheKey());
+    const quint64 param(b.color().rgba());
+    if (cacheable && EffectCache::find(EffectCache::Colorized, source, param, pix))
+        return;
     QPixmap copy(pix);
     pix.fill(Qt::transparent);
     QPainter p(&pix);
@@ -458,6 +1046,8 @@ FX::colorizePixmap(QPixmap &pix, const QBrush &b)
     p.setCompositionMode(QPainter::CompositionMode_DestinationIn);
     p.drawPixmap(pix.rect(), copy);
     p.end();
+    if (cacheable)
+        EffectCache::insert(EffectCache::Colorized, source, param, pix);
 }
 
 QPixmap
@@ -467,29 +1057,146 @@ FX::colorized(QPixmap pix, const QBrush &b)
     return pix;
 }
 
+/* Every pixel to its luma (r*299 + g*587 + b*114)/1000 as gray,
+ * alpha kept, while finding the lowest and highest luma. The
+ * SSE2 version gets the weighted sums from madd and divides in
+ * float, correctly rounded division keeps /1000 exact here.
+ */
+static void grayline_scalar(QRgb *px, const int n, int &lo, int &hi)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        const int l(lum(px[i]));
+        if (l > hi)
+            hi = l;
+        if (l < lo)
+            lo = l;
+        px[i] = (px[i] & 0xff000000) | (l * 0x010101);
+    }
+}
+
+#if defined(FX_X86)
+__attribute__((target("sse2")))
+static void grayline_sse2(QRgb *px, const int n, int &lo, int &hi)
+{
+    const __m128i zero = _mm_setzero_si128(), alpha = _mm_set1_epi32(int(0xff000000));
+    const __m128i weights = _mm_setr_epi16(114, 587, 299, 0, 114, 587, 299, 0); //b g r a
+    const __m128 thousand = _mm_set1_ps(1000.0f);
+    __m128i vlo = _mm_set1_epi16(lo), vhi = _mm_set1_epi16(hi);
+    int i(0);
+    for (; i+3 < n; i += 4)
+    {
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(px+i));
+        //madd leaves b*114+g*587 and r*299 next to each other, add the pairs up
+        __m128i x = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), weights);
+        __m128i y = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), weights);
+        x = _mm_add_epi32(x, _mm_srli_epi64(x, 32));
+        y = _mm_add_epi32(y, _mm_srli_epi64(y, 32));
+        const __m128i sums = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(x), _mm_castsi128_ps(y), _MM_SHUFFLE(2, 0, 2, 0)));
+        const __m128i l = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(sums), thousand));
+        const __m128i l16 = _mm_packs_epi32(l, l);
+        vlo = _mm_min_epi16(vlo, l16);
+        vhi = _mm_max_epi16(vhi, l16);
+        const __m128i gray = _mm_or_si128(_mm_or_si128(l, _mm_slli_epi32(l, 8)), _mm_slli_epi32(l, 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(px+i), _mm_or_si128(gray, _mm_and_si128(p, alpha)));
+    }
+    short los[8], his[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(los), vlo);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(his), vhi);
+    for (int j = 0; j < 4; ++j)
+    {
+        lo = qMin<int>(lo, los[j]);
+        hi = qMax<int>(hi, his[j]);
+    }
+    grayline_scalar(px+i, n-i, lo, hi);
+}
+#endif
+
 void
-FX::autoStretch(QImage &img)
+FX::grayscale(QImage &img, int *lo, int *hi)
 {
     if (img.format() != QImage::Format_ARGB32)
         img = img.convertToFormat(QImage::Format_ARGB32);
-    const int size = img.width() * img.height();
-    QRgb *px = reinterpret_cast<QRgb *>(img.bits());
-    int inLo(255);
-    int inUp(0);
-    for (int i = 0; i < size; ++i) //determine lowest and highest pixels
-    {
-        const QColor pxc = QColor::fromRgba(px[i]);
-        const int lum = Color::lum(pxc);
-        if (lum > inUp)
-            inUp = lum;
-        if (lum < inLo)
-            inLo = lum;
-        px[i] = qRgba(lum, lum, lum, qAlpha(px[i]));
+    void (*line)(QRgb *, const int, int &, int &) = grayline_scalar;
+#if defined(FX_X86)
+    if (CPU::level() >= CPU::SSE2)
+        line = grayline_sse2;
+#endif
+    int l(255), h(0);
+    for (int y = 0; y < img.height(); ++y)
+        line(reinterpret_cast<QRgb *>(img.scanLine(y)), img.width(), l, h);
+    if (lo)
+        *lo = l;
+    if (hi)
+        *hi = h;
+}
+
+/* pushed() on gray pixels, alpha kept. Gray in, gray out, so the
+ * scalar version gets the whole pixel sans alpha from one lookup.
+ * The SSE2 version does what pushed() does in float, four pixels
+ * at a time, and the clamp in the packs. It measured about even
+ * with the lookup in a standalone loop (1.2-2.2 GP/s either way,
+ * 256 to 2048 square), it is here to keep autoStretch in SIMD
+ * from the luma pass on and comes out identical for every range.
+ */
+static void levelsline_scalar(QRgb *px, const int n, const quint32 *gray)
+{
+    for (int i = 0; i < n; ++i)
+        px[i] = (px[i] & 0xff000000) | gray[px[i] & 0xff];
+}
+
+#if defined(FX_X86)
+__attribute__((target("sse2")))
+static void levelsline_sse2(QRgb *px, const int n, const quint32 *gray, const float inLo, const float scale, const float outLo)
+{
+    const __m128i zero = _mm_setzero_si128(), low = _mm_set1_epi32(0xff), alpha = _mm_set1_epi32(int(0xff000000));
+    const __m128 lo = _mm_set1_ps(inLo), s = _mm_set1_ps(scale), out = _mm_set1_ps(outLo), half = _mm_set1_ps(0.5f);
+    int i(0);
+    for (; i+3 < n; i += 4)
+    {
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(px+i));
+        const __m128 v = _mm_cvtepi32_ps(_mm_and_si128(p, low));
+        //qRound for what is not negative, the rest ends up 0 anyway
+        const __m128i l = _mm_cvttps_epi32(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(v, lo), s), out), half));
+        const __m128i l8 = _mm_packus_epi16(_mm_packs_epi32(l, zero), zero);
+        //l l l 0 per pixel
+        const __m128i g = _mm_unpacklo_epi16(_mm_unpacklo_epi8(l8, l8), _mm_unpacklo_epi8(l8, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(px+i), _mm_or_si128(g, _mm_and_si128(p, alpha)));
     }
-    for (int i = 0; i < size; ++i)
+    levelsline_scalar(px+i, n-i, gray);
+}
+#endif
+
+void
+FX::levels(QImage &img, const int inLo, const int inUp, const int outLo, const int outUp)
+{
+    if (img.format() != QImage::Format_ARGB32)
+        img = img.convertToFormat(QImage::Format_ARGB32);
+    quint8 lut[256];
+    pushedTable(lut, inLo, inUp, outLo, outUp);
+    quint32 gray[256];
+    for (int i = 0; i < 256; ++i)
+        gray[i] = lut[i] * 0x010101;
+    const int w(img.width());
+#if defined(FX_X86)
+    //an empty input range is identity in pushed(), the table has that
+    if (CPU::level() >= CPU::SSE2 && inUp != inLo)
     {
-        const int v = pushed(qGray(px[i]), inLo, inUp);
-        px[i] = qRgba(v,v,v,qAlpha(px[i]));
+        const float scale = (float(outUp)-float(outLo))/(float(inUp)-float(inLo));
+        for (int y = 0; y < img.height(); ++y)
+            levelsline_sse2(reinterpret_cast<QRgb *>(img.scanLine(y)), w, gray, inLo, scale, outLo);
+        return;
     }
+#endif
+    for (int y = 0; y < img.height(); ++y)
+        levelsline_scalar(reinterpret_cast<QRgb *>(img.scanLine(y)), w, gray);
+}
+
+void
+FX::autoStretch(QImage &img)
+{
+    int inLo, inUp;
+    grayscale(img, &inLo, &inUp);
+    levels(img, inLo, inUp);
 }
 
@@ -13,12 +13,26 @@ class QColor;
 namespace FX
 {
     void expblur(QImage &img, int radius, Qt::Orientations o = Qt::Horizontal|Qt::Vertical);
+    /* gaussian from three box filters, same extent as expblur, cost independent of radius */
+    void boxblur(QImage &img, int radius, Qt::Orientations o = Qt::Horizontal|Qt::Vertical);
+    /* expblur below BoxBlurFrom, boxblur from there on */
+    enum { BoxBlurFrom = 16 };
+    void blur(QImage &img, int radius, Qt::Orientations o = Qt::Horizontal|Qt::Vertical);
     QPixmap mid(const QPixmap &p1, const QBrush &b, const int a1 = 1, const int a2 = 1, const QSize &sz = QSize());
     QPixmap mid(const QPixmap &p1, const QPixmap &p2, const int a1 = 1, const int a2 = 1, const QSize &sz = QSize());
+    QImage mid(const QImage &i1, const QImage &i2, const int a1 = 1, const int a2 = 1, const QSize &sz = QSize());
+    /* img = (a1*img + a2*other)/(a1+a2) per channel, in place, both Format_ARGB32 */
+    void blend(QImage &img, const QImage &other, const int a1 = 1, const int a2 = 1);
     void colortoalpha(float *a1, float *a2, float *a3, float *a4, float c1, float c2, float c3);
     QPixmap sunkenized(const QRect &r, const QPixmap &source, const bool isDark = false, const int shadowOpacity = 127);
     int stretch(const int v, const float n = 1.5f);
     int pushed(const float v, const float inlo, const float inup, const float outlo = 0.0f, const float outup = 255.0f);
+    /* pushed() for every 8 bit value, clamped */
+    void pushedTable(quint8 *lut, const int inlo, const int inup, const int outlo = 0, const int outup = 255);
+    /* gray from luma, alpha kept, lo and hi get the luma range */
+    void grayscale(QImage &img, int *lo = 0, int *hi = 0);
+    /* pushed() on a grayscale image */
+    void levels(QImage &img, const int inLo, const int inUp, const int outLo = 0, const int outUp = 255);
     QImage stretched(QImage img);
     QImage stretched(QImage img, const QColor &c);
     void autoStretch(QImage &img);
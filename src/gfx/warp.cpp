@@ -0,0 +1,186 @@
+#include "warp.h"
+#include "cpu.h"
+#include <QImage>
+#include <QTransform>
+#include <qmath.h>
+
+/*
+// Perspective warp ================================================
+*  Inverse mapping, for each destination pixel the homogeneous
+*  source coordinate (u, v, w) is linear along the row so it is
+*  stepped, only the division by w is per pixel. Samples are
+*  bilinear at FracBits precision and composited source over.
+*  The scalar and the SSE2 rows step and round alike, pixel for
+*  pixel they give the same result, which one runs is up to
+*  CPU::level() like for the other kernels.
+*/
+
+enum { FracBits = 7, FracOne = 1 << FracBits, FracMask = FracOne - 1 };
+
+struct WarpSource
+{
+    const uint *bits;
+    int bpl, w, h;
+    float maxX, maxY;
+};
+
+/* the homogeneous source coordinate at the row start and its step */
+struct WarpRow
+{
+    float u, v, w, du, dv, dw;
+};
+
+static inline uint interpolate(const uint a, const uint b, const int f)
+{
+    //two channels at a time, each in its own 16 bits
+    const uint rb = (((a & 0xff00ff)*(FracOne-f) + (b & 0xff00ff)*f) >> FracBits) & 0xff00ff;
+    const uint ag = ((((a >> 8) & 0xff00ff)*(FracOne-f) + ((b >> 8) & 0xff00ff)*f) >> FracBits) & 0xff00ff;
+    return rb | (ag << 8);
+}
+
+static inline uint byteMul(uint x, const uint a)
+{
+    uint t = (x & 0xff00ff)*a;
+    t = ((t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8) & 0xff00ff;
+    x = ((x >> 8) & 0xff00ff)*a;
+    x = (x + ((x >> 8) & 0xff00ff) + 0x800080) & 0xff00ff00;
+    return x | t;
+}
+
+/* sample src at fixed point (fx, fy) and draw it over d */
+static inline uint sampleOver_scalar(const WarpSource &src, const int fx, const int fy, const uint d)
+{
+    const int x0 = fx >> FracBits, y0 = fy >> FracBits;
+    const int x1 = qMin(x0+1, src.w-1), y1 = qMin(y0+1, src.h-1);
+    const uint *r0 = src.bits + y0*src.bpl, *r1 = src.bits + y1*src.bpl;
+    const uint c = interpolate(interpolate(r0[x0], r0[x1], fx & FracMask), interpolate(r1[x0], r1[x1], fx & FracMask), fy & FracMask);
+    return c + byteMul(d, 255 - qAlpha(c));
+}
+
+/* pixels left...right of a row, in blocks of four like the lanes
+ * below, each one step off the block start and divided by a reciprocal
+ */
+static void warprow_scalar(uint *d, const WarpSource &src, WarpRow r, const int left, const int right)
+{
+    for (int x = left; x <= right; x += 4, r.u += 4.0f*r.du, r.v += 4.0f*r.dv, r.w += 4.0f*r.dw)
+        for (int i = 0; i < 4 && x+i <= right; ++i)
+        {
+            const float W = r.w + float(i)*r.dw;
+            if (W <= 0.0f)
+                continue;
+            const float rw = 1.0f/W;
+            const float sx = (r.u + float(i)*r.du)*rw-0.5f, sy = (r.v + float(i)*r.dv)*rw-0.5f;
+            if (sx < -0.5f || sx >= src.maxX+0.5f || sy < -0.5f || sy >= src.maxY+0.5f)
+                continue;
+            const int fx = int(qMin(qMax(sx, 0.0f), src.maxX)*FracOne), fy = int(qMin(qMax(sy, 0.0f), src.maxY)*FracOne);
+            d[x+i] = sampleOver_scalar(src, fx, fy, d[x+i]);
+        }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WARP_X86
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static inline uint sampleOver_sse2(const WarpSource &src, const int fx, const int fy, const uint d)
+{
+    const int x0 = fx >> FracBits, y0 = fy >> FracBits;
+    const int x1 = qMin(x0+1, src.w-1), y1 = qMin(y0+1, src.h-1);
+    const uint *r0 = src.bits + y0*src.bpl, *r1 = src.bits + y1*src.bpl;
+    const __m128i zero = _mm_setzero_si128();
+    //left texels in l, right ones in r, top row in the low half, 16 bits a channel
+    const __m128i l = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(int(r0[x0])), _mm_cvtsi32_si128(int(r1[x0]))), zero);
+    const __m128i r = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(int(r0[x1])), _mm_cvtsi32_si128(int(r1[x1]))), zero);
+    const __m128i hz = _mm_add_epi16(l, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(r, l), _mm_set1_epi16(fx & FracMask)), FracBits));
+    const __m128i c = _mm_add_epi16(hz, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(_mm_srli_si128(hz, 8), hz), _mm_set1_epi16(fy & FracMask)), FracBits));
+    //premultiplied source over: c + d*(255-a)/255
+    const __m128i a = _mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i t = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(int(d)), zero), _mm_sub_epi16(_mm_set1_epi16(255), a));
+    t = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), _mm_set1_epi16(0x80)), 8);
+    return uint(_mm_cvtsi128_si32(_mm_packus_epi16(_mm_add_epi16(c, t), zero)));
+}
+
+/* four pixels a go, one division for all of them */
+__attribute__((target("sse2")))
+static void warprow_sse2(uint *d, const WarpSource &src, WarpRow r, const int left, const int right)
+{
+    const __m128 step = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    const __m128 half = _mm_set1_ps(0.5f), one = _mm_set1_ps(FracOne), zero = _mm_setzero_ps();
+    const __m128 lo = _mm_set1_ps(-0.5f), hiX = _mm_set1_ps(src.maxX+0.5f), hiY = _mm_set1_ps(src.maxY+0.5f);
+    const __m128 mX = _mm_set1_ps(src.maxX), mY = _mm_set1_ps(src.maxY);
+    int fx[4], fy[4];
+    int x = left;
+    for (; x+3 <= right; x += 4)
+    {
+        const __m128 U = _mm_add_ps(_mm_set1_ps(r.u), _mm_mul_ps(step, _mm_set1_ps(r.du)));
+        const __m128 V = _mm_add_ps(_mm_set1_ps(r.v), _mm_mul_ps(step, _mm_set1_ps(r.dv)));
+        const __m128 W = _mm_add_ps(_mm_set1_ps(r.w), _mm_mul_ps(step, _mm_set1_ps(r.dw)));
+        const __m128 rw = _mm_div_ps(_mm_set1_ps(1.0f), W);
+        const __m128 sx = _mm_sub_ps(_mm_mul_ps(U, rw), half);
+        const __m128 sy = _mm_sub_ps(_mm_mul_ps(V, rw), half);
+        const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(W, zero), _mm_and_ps(_mm_cmpge_ps(sx, lo), _mm_cmplt_ps(sx, hiX))),
+                                         _mm_and_ps(_mm_cmpge_ps(sy, lo), _mm_cmplt_ps(sy, hiY)));
+        const int mask = _mm_movemask_ps(inside);
+        r.u += 4.0f*r.du;
+        r.v += 4.0f*r.dv;
+        r.w += 4.0f*r.dw;
+        if (!mask)
+            continue;
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(fx), _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(sx, zero), mX), one)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(fy), _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(sy, zero), mY), one)));
+        for (int i = 0; i < 4; ++i)
+            if (mask & (1 << i))
+                d[x+i] = sampleOver_sse2(src, fx[i], fy[i], d[x+i]);
+    }
+    if (x <= right)
+        warprow_scalar(d, src, r, x, right);
+}
+#endif
+
+void
+FX::warp(QImage &dst, const QImage &src, const QTransform &transform, const QRect &clip)
+{
+    if (src.isNull() || dst.isNull()
+            || src.format() != QImage::Format_ARGB32_Premultiplied
+            || dst.format() != QImage::Format_ARGB32_Premultiplied)
+        return;
+
+    bool invertible(false);
+    const QTransform inv = transform.inverted(&invertible);
+    if (!invertible)
+        return;
+
+    QRect area = transform.mapRect(QRectF(src.rect())).toAlignedRect() & dst.rect();
+    if (clip.isValid())
+        area &= clip;
+    if (area.isEmpty())
+        return;
+
+    typedef void (*Row)(uint *, const WarpSource &, WarpRow, const int, const int);
+    Row row(warprow_scalar);
+#if defined(WARP_X86)
+    if (CPU::level() >= CPU::SSE2)
+        row = warprow_sse2;
+#endif
+
+    WarpSource s;
+    s.bits = reinterpret_cast<const uint *>(src.constBits());
+    s.bpl = src.bytesPerLine()/4;
+    s.w = src.width();
+    s.h = src.height();
+    s.maxX = s.w-1;
+    s.maxY = s.h-1;
+
+    WarpRow r;
+    r.du = inv.m11();
+    r.dv = inv.m12();
+    r.dw = inv.m13();
+    for (int y = area.top(); y <= area.bottom(); ++y)
+    {
+        const float py = y+0.5f, px = area.left()+0.5f;
+        r.u = inv.m11()*px + inv.m21()*py + inv.m31();
+        r.v = inv.m12()*px + inv.m22()*py + inv.m32();
+        r.w = inv.m13()*px + inv.m23()*py + inv.m33();
+        row(reinterpret_cast<uint *>(dst.scanLine(y)), s, r, area.left(), area.right());
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef WARP_H
+#define WARP_H
+
+#include <QRect>
+
+class QImage;
+class QTransform;
+
+namespace FX
+{
+    /* Draws src over dst through a perspective transform, mapping
+     * src pixel coordinates to dst pixel coordinates. Every dst pixel
+     * inside clip is mapped back into src and sampled bilinearly, the
+     * homography divisions are done four pixels at a time with SSE2
+     * when CPU::level() allows it.
+     * Both images have to be Format_ARGB32_Premultiplied.
+     */
+    void warp(QImage &dst, const QImage &src, const QTransform &transform, const QRect &clip = QRect());
+}
+
+#endif // WARP_H
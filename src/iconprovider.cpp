@@ -26,6 +26,10 @@
 #include <QStyle>
 #include <QStyleOption>
 #include <QPainterPath>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+#include <qmath.h>
 
 using namespace DocSurf;
 
@@ -41,38 +45,51 @@ IconProvider::triangle(bool back, int size)
     return pol;
 }
 
+const QString
+IconProvider::themeName(const Type type)
+{
+    switch (type)
+    {
+    case IconView : return "view-list-icons";
+    case DetailsView : return "view-list-details";
+    case ColumnsView : return "view-file-columns";
+    case FlowView : return "view-preview";
+    case GoBack : return "go-previous";
+    case GoForward : return "go-next";
+    case Configure : return "configure";
+    case GoHome : return "go-home";
+    case Search : return "edit-find";
+    case Clear : return "list-remove";
+    case Sort : return "view-sort-ascending";
+    case Hidden : return "inode-directory";
+    case CloseTab : return "tab-close";
+    case NewTab : return "tab-new";
+    default : return QString();
+    }
+}
+
+bool
+IconProvider::usesStyle(const Type type)
+{
+    //QStyle may only be used on the gui thread
+    return type == GoBack || type == GoForward || type == Sort;
+}
+
 const QIcon
 IconProvider::icon(Type type, int size, QColor color)
 {
-//    if (themeIcon)
-//    {
-        QString iconString;
-        switch (type)
-        {
-        case IconView : iconString = "view-list-icons"; break;
-        case DetailsView : iconString  = "view-list-details"; break;
-        case ColumnsView : iconString = "view-file-columns"; break;
-        case FlowView : iconString = "view-preview"; break;
-        case GoBack : iconString = "go-previous"; break;
-        case GoForward : iconString = "go-next"; break;
-        case Configure : iconString = "configure"; break;
-        case GoHome : iconString = "go-home"; break;
-        case Search : iconString = "edit-find"; break;
-        case Clear : iconString = "list-remove"; break;
-        case Sort : iconString = "view-sort-ascending"; break;
-        case Hidden : iconString = "inode-directory"; break;
-        case CloseTab : iconString = "tab-close"; break;
-        case NewTab : iconString = "tab-new"; break;
-        default : iconString = "";
-        }
-        if (QIcon::hasThemeIcon(iconString))
-            return QIcon::fromTheme(iconString);
-//    }
+    return IconCache::instance()->icon(type, size, color);
+}
 
-    QPixmap pix(size, size);
+QImage
+IconProvider::render(Type type, int size, QColor color, const qreal dpr)
+{
+    QImage pix(qCeil(size*dpr), qCeil(size*dpr), QImage::Format_ARGB32_Premultiplied);
+    pix.setDevicePixelRatio(dpr);
     pix.fill(Qt::transparent);
     QPainter p(&pix);
-    QRect rect(pix.rect());
+    const QRect area(0, 0, size, size);
+    QRect rect(area);
     int min = size / 16, sz = (size/4)-min;
     p.setPen(color);
     switch (type)
@@ -163,12 +180,12 @@ IconProvider::icon(Type type, int size, QColor color)
         p.resetTransform();
         const int outer = _4pt-_1pt;
         p.setPen(Qt::NoPen);
-        p.drawEllipse(pix.rect().adjusted(outer, outer, -outer, -outer));
+        p.drawEllipse(area.adjusted(outer, outer, -outer, -outer));
         p.setCompositionMode(QPainter::CompositionMode_DestinationOut);
         p.setBrush(Qt::black);
-        p.drawEllipse(pix.rect().adjusted(_8pt-_2pt, _8pt-_2pt, -(_8pt-_2pt), -(_8pt-_2pt)));
+        p.drawEllipse(area.adjusted(_8pt-_2pt, _8pt-_2pt, -(_8pt-_2pt), -(_8pt-_2pt)));
         p.setCompositionMode(QPainter::CompositionMode_DestinationIn);
-        p.drawEllipse(pix.rect().adjusted(_1pt, _1pt, -_1pt, -_1pt));
+        p.drawEllipse(area.adjusted(_1pt, _1pt, -_1pt, -_1pt));
         break;
     }
     case GoHome :
@@ -325,7 +342,8 @@ IconProvider::icon(Type type, int size, QColor color)
     }
     case Animator:
     {
-        QPixmap temp(pix.size());
+        QImage temp(pix.size(), QImage::Format_ARGB32_Premultiplied);
+        temp.setDevicePixelRatio(dpr);
         temp.fill(Qt::transparent);
         QPainter tp(&temp);
         tp.setPen(Qt::NoPen);
@@ -349,7 +367,7 @@ IconProvider::icon(Type type, int size, QColor color)
         tp.end();
 
         p.setRenderHint(QPainter::Antialiasing);
-        p.setPen(QPen(temp, 3));
+        p.setPen(QPen(QBrush(temp), 3));
         p.drawEllipse(rect.adjusted(3, 3, -3, -3));
         break;
     }
@@ -390,5 +408,228 @@ IconProvider::icon(Type type, int size, QColor color)
         default: break;
     }
     p.end();
-    return QIcon(pix);
+    return pix;
+}
+
+class AtlasTask : public QRunnable
+{
+public:
+    AtlasTask(IconCache *cache, const int generation, const QList<QPair<IconCache::Key, QRect> > &jobs, const QSize &size)
+        : QRunnable()
+        , m_cache(cache)
+        , m_generation(generation)
+        , m_jobs(jobs)
+        , m_size(size)
+    {
+    }
+    void run()
+    {
+        QImage atlas(m_size, QImage::Format_ARGB32_Premultiplied);
+        atlas.fill(Qt::transparent);
+        QPainter p(&atlas);
+        p.setCompositionMode(QPainter::CompositionMode_Source);
+        for (int i = 0; i < m_jobs.count(); ++i)
+        {
+            const IconCache::Key &key = m_jobs.at(i).first;
+            const QImage &img = IconProvider::render(IconProvider::Type(key.type), key.size, key.valid ? QColor::fromRgba(key.color) : QColor(), key.dpr);
+            //both in device pixels, nothing gets scaled
+            p.drawImage(m_jobs.at(i).second, img, img.rect());
+        }
+        p.end();
+        QMetaObject::invokeMethod(m_cache, "atlasReady", Qt::QueuedConnection, Q_ARG(int, m_generation), Q_ARG(QImage, atlas));
+    }
+
+private:
+    IconCache *m_cache;
+    int m_generation;
+    QList<QPair<IconCache::Key, QRect> > m_jobs;
+    QSize m_size;
+};
+
+IconCache *IconCache::s_instance = 0;
+
+IconCache
+*IconCache::instance()
+{
+    if (!s_instance)
+        s_instance = new IconCache(qApp);
+    return s_instance;
+}
+
+IconCache::IconCache(QObject *parent)
+    : QObject(parent)
+    , Cacheable(Rebuildable)
+    , m_icons(MaxIconBytes)
+    , m_themed(MaxThemed)
+    , m_themedPixmaps(MaxThemedBytes)
+    , m_warmTimer(new QTimer(this))
+    , m_generation(0)
+{
+    m_warmTimer->setInterval(0);
+    connect(m_warmTimer, &QTimer::timeout, this, &IconCache::warmStep);
+}
+
+IconCache::Key
+IconCache::key(const IconProvider::Type type, const int size, const QColor &color, const qreal dpr)
+{
+    Key k;
+    k.type = type;
+    k.size = size;
+    k.color = color.isValid() ? color.rgba() : 0;
+    k.valid = color.isValid();
+    k.dpr = dpr;
+    return k;
+}
+
+const QIcon
+IconCache::icon(const IconProvider::Type type, const int size, const QColor &color)
+{
+    const QIcon &theme = themeIcon(type);
+    if (!theme.isNull())
+        return theme;
+
+    const Key k = key(type, size, color, qApp->devicePixelRatio());
+    if (const QIcon *cached = m_icons.object(k))
+        return *cached;
+    const QImage &img = IconProvider::render(type, size, color, k.dpr);
+    insert(k, img);
+    //bigger than the whole cache is not kept
+    const QIcon *cached = m_icons.object(k);
+    return cached ? *cached : QIcon(QPixmap::fromImage(img));
+}
+
+const QIcon
+IconCache::themeIcon(const IconProvider::Type type)
+{
+    if (!m_theme.contains(type))
+    {
+        const QString &name = IconProvider::themeName(type);
+        m_theme.insert(type, !name.isEmpty() && QIcon::hasThemeIcon(name) ? QIcon::fromTheme(name) : QIcon());
+    }
+    return m_theme.value(type);
+}
+
+void
+IconCache::insert(const Key &key, const QImage &img)
+{
+    m_icons.insert(key, new QIcon(QPixmap::fromImage(img)), qMax(1, img.bytesPerLine()*img.height()));
+}
+
+void
+IconCache::warmUp(const int size, const QColor &color)
+{
+    if (!m_atlas.isEmpty())
+        return;
+    const qreal dpr = qApp->devicePixelRatio();
+    const int extent = qCeil(size*dpr);
+    for (int t = IconProvider::IconView; t <= IconProvider::NewTab; ++t)
+    {
+        const IconProvider::Type type = IconProvider::Type(t);
+        const Key k = key(type, size, color, dpr);
+        //theme lookups stay on this thread, what the theme has needs no drawing
+        if (IconProvider::usesStyle(type) || m_icons.contains(k) || !themeIcon(type).isNull())
+            continue;
+        m_atlas << qMakePair(k, QRect(m_atlas.count()*extent, 0, extent, extent));
+    }
+    if (m_atlas.isEmpty())
+        return;
+    QThreadPool::globalInstance()->start(new AtlasTask(this, m_generation, m_atlas, QSize(m_atlas.count()*extent, extent)));
+}
+
+void
+IconCache::atlasReady(const int generation, const QImage &atlas)
+{
+    const QList<QPair<Key, QRect> > jobs = m_atlas;
+    m_atlas.clear();
+    if (generation != m_generation)
+        return;
+    for (int i = 0; i < jobs.count(); ++i)
+    {
+        if (m_icons.contains(jobs.at(i).first))
+            continue;
+        QImage img = atlas.copy(jobs.at(i).second);
+        img.setDevicePixelRatio(jobs.at(i).first.dpr);
+        insert(jobs.at(i).first, img);
+    }
+}
+
+const QIcon
+IconCache::themed(const QString &name)
+{
+    if (const QIcon *cached = m_themed.object(name))
+        return *cached;
+    //the same fallback KDirModel ends up with
+    const QIcon icon = QIcon::fromTheme(name, QIcon::fromTheme("unknown"));
+    m_themed.insert(name, new QIcon(icon));
+    return icon;
+}
+
+QPixmap
+IconCache::themedPixmap(const QString &name, const QSize &size, const QIcon::Mode mode, const QIcon::State state)
+{
+    ThemedKey k;
+    k.name = name;
+    k.size = size;
+    k.mode = mode;
+    k.state = state;
+    k.dpr = qApp->devicePixelRatio();
+    if (const QPixmap *cached = m_themedPixmaps.object(k))
+        return *cached;
+    const QPixmap pix = themed(name).pixmap(size, mode, state);
+    if (pix.isNull())
+        return pix;
+    m_themedPixmaps.insert(k, new QPixmap(pix), qMax(1, pix.width()*pix.height()*pix.depth()/8));
+    return pix;
+}
+
+void
+IconCache::warmThemed(const QStringList &names, const QSize &size)
+{
+    if (names.isEmpty() || size.isEmpty())
+        return;
+    if (size != m_warmSize)
+        m_warmQueue.clear();
+    m_warmSize = size;
+    m_warmQueue << names;
+    if (!m_warmTimer->isActive())
+        m_warmTimer->start();
+}
+
+void
+IconCache::warmStep()
+{
+    //a few per pass, input and painting go in between
+    for (int i = 0; i < WarmBatch && !m_warmQueue.isEmpty(); ++i)
+        themedPixmap(m_warmQueue.takeFirst(), m_warmSize);
+    if (m_warmQueue.isEmpty())
+        m_warmTimer->stop();
+}
+
+void
+IconCache::clear()
+{
+    //an atlas still on its way was drawn for what is dropped here
+    ++m_generation;
+    m_icons.clear();
+    m_theme.clear();
+    m_themed.clear();
+    m_themedPixmaps.clear();
+    m_warmQueue.clear();
+}
+
+void
+IconCache::shrinkCache(const qint64 bytes)
+{
+    //a lower max cost trims from the least recently used end,
+    //the themed pixmaps first, there are many more of them
+    qint64 left(bytes);
+    const int themed = m_themedPixmaps.totalCost(), themedMax = m_themedPixmaps.maxCost();
+    m_themedPixmaps.setMaxCost(int(qMax<qint64>(0, themed-left)));
+    m_themedPixmaps.setMaxCost(themedMax);
+    left -= themed-m_themedPixmaps.totalCost();
+    if (left <= 0)
+        return;
+    const int iconsMax = m_icons.maxCost();
+    m_icons.setMaxCost(int(qMax<qint64>(0, m_icons.totalCost()-left)));
+    m_icons.setMaxCost(iconsMax);
 }
@@ -26,6 +26,14 @@
 #include <QPixmap>
 #include <QImage>
 #include <QPainter>
+#include <QHash>
+#include <QCache>
+#include <QList>
+#include <QPair>
+#include <QStringList>
+#include "cachegovernor.h"
+
+class QTimer;
 
 namespace DocSurf
 {
@@ -53,6 +61,97 @@ enum Type { IconView = 0,
           };
 
 const QIcon icon(Type type, int size = 16, QColor color = QColor());
+/* the vector fallback for type at size logical pixels, safe
+ * to call off the gui thread unless usesStyle(type)
+ */
+QImage render(Type type, int size, QColor color, const qreal dpr = 1.0f);
+bool usesStyle(const Type type);
+const QString themeName(const Type type);
+}
+
+/* Every icon IconProvider hands out, keyed by what it was drawn
+ * with, so asking again is a hash lookup. Whether the theme has
+ * an icon is looked up once per type. warmUp() draws the vector
+ * icons that do not need the style into a single atlas image on
+ * a worker thread, on arrival it is cut up into the cache.
+ * Theme icons by name, like the ones of file items and tabs, are
+ * resolved once per session and their pixmaps kept per size,
+ * mode, state and device pixel ratio. warmThemed() fills that in
+ * from the event loop a few names at a time.
+ */
+class IconCache : public QObject, public Cacheable
+{
+    Q_OBJECT
+public:
+    /* the pixmaps are kept within MaxIconBytes and MaxThemedBytes, least recently used go first */
+    enum { MaxIconBytes = 4*1024*1024, MaxThemedBytes = 32*1024*1024, MaxThemed = 4096, WarmBatch = 8 };
+    struct Key
+    {
+        int type;
+        int size;
+        QRgb color;
+        bool valid;
+        qreal dpr;
+        bool operator==(const Key &other) const
+        {
+            return type == other.type && size == other.size && color == other.color && valid == other.valid && dpr == other.dpr;
+        }
+    };
+    struct ThemedKey
+    {
+        QString name;
+        QSize size;
+        int mode;
+        int state;
+        qreal dpr;
+        bool operator==(const ThemedKey &other) const
+        {
+            return name == other.name && size == other.size && mode == other.mode && state == other.state && dpr == other.dpr;
+        }
+    };
+    static IconCache *instance();
+    const QIcon icon(const IconProvider::Type type, const int size, const QColor &color);
+    void warmUp(const int size = 16, const QColor &color = QColor());
+    const QIcon themed(const QString &name);
+    QPixmap themedPixmap(const QString &name, const QSize &size, const QIcon::Mode mode = QIcon::Normal, const QIcon::State state = QIcon::Off);
+    void warmThemed(const QStringList &names, const QSize &size);
+    void clear();
+
+    QString cacheName() const { return "icons"; }
+    qint64 cacheCost() const { return m_icons.totalCost() + m_themedPixmaps.totalCost(); }
+    void shrinkCache(const qint64 bytes);
+
+protected:
+    explicit IconCache(QObject *parent = 0);
+
+private slots:
+    void atlasReady(const int generation, const QImage &atlas);
+    void warmStep();
+
+private:
+    static Key key(const IconProvider::Type type, const int size, const QColor &color, const qreal dpr);
+    const QIcon themeIcon(const IconProvider::Type type);
+    void insert(const Key &key, const QImage &img);
+    static IconCache *s_instance;
+    QCache<Key, QIcon> m_icons;
+    QHash<int, QIcon> m_theme;
+    QList<QPair<Key, QRect> > m_atlas;
+    QCache<QString, QIcon> m_themed;
+    QCache<ThemedKey, QPixmap> m_themedPixmaps;
+    QStringList m_warmQueue;
+    QSize m_warmSize;
+    QTimer *m_warmTimer;
+    int m_generation;
+};
+
+inline uint qHash(const IconCache::Key &key, uint seed = 0)
+{
+    return qHash((key.type << 24) ^ (key.size << 1) ^ key.valid, seed) ^ qHash(key.color) ^ qHash(qRound(key.dpr*100));
+}
+
+inline uint qHash(const IconCache::ThemedKey &key, uint seed = 0)
+{
+    return qHash(key.name, seed) ^ qHash((key.size.width() << 16) | key.size.height()) ^ qHash((key.mode << 24) ^ (key.state << 20) ^ qRound(key.dpr*100));
 }
 
 }
@@ -0,0 +1,164 @@
+/**************************************************************************
+*   Copyright (C) 2013 by Robert Metsaranta                               *
+*   therealestrob@gmail.com                                               *
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program; if not, write to the                         *
+*   Free Software Foundation, Inc.,                                       *
+*   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+***************************************************************************/
+
+
+#include "imagepreparer.h"
+#include <QRunnable>
+#include <QThread>
+#include <QPainter>
+#include <QApplication>
+
+using namespace DocSurf;
+
+class PrepareTask : public QRunnable
+{
+public:
+    PrepareTask(ImagePreparer *preparer, const int ticket, const QImage &source, const ImagePreparer::Key &key)
+        : QRunnable()
+        , m_preparer(preparer)
+        , m_ticket(ticket)
+        , m_source(source)
+        , m_key(key)
+    {
+    }
+    void run()
+    {
+        QImage img(m_source);
+        if (img.size() != m_key.size)
+            img = img.scaled(m_key.size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        img = img.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        if (m_key.kind == ImagePreparer::Reflection)
+        {
+            img = img.mirrored(false, true);
+            QPainter p(&img);
+            p.fillRect(img.rect(), QColor::fromRgba(m_key.tint));
+            p.end();
+        }
+        QMetaObject::invokeMethod(m_preparer, "imageReady", Qt::QueuedConnection, Q_ARG(int, m_ticket), Q_ARG(QImage, img));
+    }
+
+private:
+    ImagePreparer *m_preparer;
+    int m_ticket;
+    QImage m_source;
+    ImagePreparer::Key m_key;
+};
+
+ImagePreparer *ImagePreparer::s_instance = 0;
+
+ImagePreparer
+*ImagePreparer::instance()
+{
+    if (!s_instance)
+        s_instance = new ImagePreparer(qApp);
+    return s_instance;
+}
+
+ImagePreparer::ImagePreparer(QObject *parent)
+    : QObject(parent)
+    , Cacheable(Disposable)
+    , m_ticket(0)
+{
+    m_pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()-1));
+    m_cache.setMaxCost(64*1024*1024);
+    m_reflections.setMaxCost(32*1024*1024);
+}
+
+ImagePreparer::~ImagePreparer()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+    if (s_instance == this)
+        s_instance = 0;
+}
+
+QPixmap
+ImagePreparer::prepared(const QUrl &url, const QPixmap &source, const QSize &size, const Kind kind, const QColor &tint)
+{
+    if (source.isNull() || size.isEmpty())
+        return QPixmap();
+    if (kind == Fit && source.size() == size)
+        return source;
+
+    Key key;
+    key.source = source.cacheKey();
+    key.size = size;
+    key.kind = kind;
+    key.tint = tint.rgba();
+    if (QPixmap *pix = cacheFor(kind).object(key))
+        return *pix;
+    if (m_pending.contains(key))
+        return QPixmap();
+
+    const int ticket = ++m_ticket;
+    m_pending.insert(key, ticket);
+    m_tickets.insert(ticket, qMakePair(key, url));
+    //QPixmap is not safe to touch off the gui thread, hand over the image
+    m_pool.start(new PrepareTask(this, ticket, source.toImage(), key));
+    return QPixmap();
+}
+
+QPixmap
+ImagePreparer::reflection(const QUrl &url, const QPixmap &source, const QColor &tint)
+{
+    //it gets faded and tinted anyway, nobody sees the lost detail
+    return prepared(url, source, QSize(qMax(1, source.width()/2), qMax(1, source.height()/2)), Reflection, tint);
+}
+
+void
+ImagePreparer::imageReady(const int ticket, const QImage &image)
+{
+    if (!m_tickets.contains(ticket))
+        return;
+    const QPair<Key, QUrl> job = m_tickets.take(ticket);
+    m_pending.remove(job.first);
+    QPixmap *pix = new QPixmap(QPixmap::fromImage(image));
+    cacheFor(job.first.kind).insert(job.first, pix, qMax(1, image.byteCount()));
+    emit ready(job.second);
+}
+
+void
+ImagePreparer::shrink(QCache<Key, QPixmap> &cache, const qint64 bytes)
+{
+    //lowering the max cost makes QCache drop the least recently used
+    const int maxCost = cache.maxCost();
+    cache.setMaxCost(qMax<qint64>(0, cache.totalCost()-bytes));
+    cache.setMaxCost(maxCost);
+}
+
+void
+ImagePreparer::shrinkCache(const qint64 bytes)
+{
+    //scaled images are redone on the next paint, reflections
+    //only when a cover comes into view again, so they go last
+    const qint64 scaled = m_cache.totalCost();
+    shrink(m_cache, bytes);
+    shrink(m_reflections, bytes-(scaled-m_cache.totalCost()));
+}
+
+void
+ImagePreparer::clear()
+{
+    m_pool.clear();
+    m_cache.clear();
+    m_reflections.clear();
+    m_pending.clear();
+    m_tickets.clear();
+}
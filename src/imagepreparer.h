@@ -0,0 +1,105 @@
+/**************************************************************************
+*   Copyright (C) 2013 by Robert Metsaranta                               *
+*   therealestrob@gmail.com                                               *
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program; if not, write to the                         *
+*   Free Software Foundation, Inc.,                                       *
+*   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+***************************************************************************/
+
+
+#ifndef IMAGEPREPARER_H
+#define IMAGEPREPARER_H
+
+#include <QObject>
+#include <QPixmap>
+#include <QImage>
+#include <QColor>
+#include <QCache>
+#include <QHash>
+#include <QUrl>
+#include <QThreadPool>
+#include "cachegovernor.h"
+
+namespace DocSurf
+{
+
+/* Produces ready to blit, premultiplied pixmaps at the exact
+ * size a view is going to draw them at. The scaling happens on
+ * worker threads, paint code only ever asks for the result and
+ * blits it, or draws the unscaled source until it is ready.
+ * ready(url) is emitted when a prepared image for url arrives.
+ * Reflections are kept apart from the scaled images, they are
+ * made at half the source resolution once per thumbnail and
+ * outlive the scaled ones when memory gets short.
+ */
+class ImagePreparer : public QObject, public Cacheable
+{
+    Q_OBJECT
+public:
+    enum Kind { Fit = 0, Reflection };
+    struct Key
+    {
+        qint64 source;
+        QSize size;
+        int kind;
+        QRgb tint;
+        bool operator==(const Key &other) const
+        {
+            return source == other.source && size == other.size && kind == other.kind && tint == other.tint;
+        }
+    };
+    static ImagePreparer *instance();
+    ~ImagePreparer();
+
+    /* size is in device pixels, a null pixmap is returned
+     * while the image is still being prepared.
+     */
+    QPixmap prepared(const QUrl &url, const QPixmap &source, const QSize &size, const Kind kind = Fit, const QColor &tint = QColor());
+    /* flipped and tinted source, to be drawn stretched back to the source size */
+    QPixmap reflection(const QUrl &url, const QPixmap &source, const QColor &tint);
+    void clear();
+
+    QString cacheName() const { return "prepared images"; }
+    qint64 cacheCost() const { return m_cache.totalCost()+m_reflections.totalCost(); }
+    void shrinkCache(const qint64 bytes);
+
+signals:
+    void ready(const QUrl &url);
+
+protected:
+    explicit ImagePreparer(QObject *parent = 0);
+
+private slots:
+    void imageReady(const int ticket, const QImage &image);
+
+private:
+    QCache<Key, QPixmap> &cacheFor(const int kind) { return kind == Reflection ? m_reflections : m_cache; }
+    static void shrink(QCache<Key, QPixmap> &cache, const qint64 bytes);
+    static ImagePreparer *s_instance;
+    QThreadPool m_pool;
+    QCache<Key, QPixmap> m_cache, m_reflections;
+    QHash<Key, int> m_pending;
+    QHash<int, QPair<Key, QUrl> > m_tickets;
+    int m_ticket;
+};
+
+inline uint qHash(const ImagePreparer::Key &key, uint seed = 0)
+{
+    return qHash(key.source, seed) ^ qHash((key.size.width() << 16) | key.size.height()) ^ qHash((key.kind << 24) ^ key.tint);
+}
+
+}
+
+#endif // IMAGEPREPARER_H
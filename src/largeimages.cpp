@@ -0,0 +1,239 @@
+/**************************************************************************
+*   Copyright (C) 2013 by Robert Metsaranta                               *
+*   therealestrob@gmail.com                                               *
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program; if not, write to the                         *
+*   Free Software Foundation, Inc.,                                       *
+*   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+***************************************************************************/
+
+
+#include <QRunnable>
+#include <QImageReader>
+#include <QPainter>
+#include <QTransform>
+
+#include "largeimages.h"
+
+using namespace DocSurf;
+using namespace FS;
+
+static inline qint64 bytesFor(const QSize &size)
+{
+    return qint64(size.width())*size.height()*4;
+}
+
+class LargeImageTask : public QRunnable
+{
+public:
+    LargeImageTask(LargeImageLoader *loader, const QUrl &url, const int extent)
+        : QRunnable()
+        , m_loader(loader)
+        , m_url(url)
+        , m_path(url.toLocalFile())
+        , m_extent(extent)
+        , m_transformation(QImageIOHandler::TransformationNone)
+    {
+    }
+    void run()
+    {
+        QImageReader reader(m_path);
+        const QSize full = reader.size();
+        if (!full.isValid())
+            return decline();
+        //sizes and clip rects below are all as stored, the exif
+        //orientation is applied to what comes out of the decoder
+        m_transformation = reader.transformation();
+
+        const QSize target = full.scaled(m_extent, m_extent, Qt::KeepAspectRatio).boundedTo(full);
+
+        //pyramidal images (tiled tiffs mostly) carry reduced copies as
+        //subimages, use the smallest one still covering the target and
+        //the smallest one of all as the placeholder
+        int level(-1), smallest(-1);
+        QSize levelSize(full), smallestSize(full);
+        if (reader.imageCount() > 1)
+            for (int i = 1; i < reader.imageCount(); ++i)
+            {
+                if (!reader.jumpToImage(i))
+                    break;
+                const QSize &sz = reader.size();
+                //other pages of a multipage document are not reductions
+                if (!sz.isValid() || qAbs(qreal(sz.width())/sz.height() - qreal(full.width())/full.height()) > 0.01)
+                    continue;
+                if (sz.width() >= target.width() && sz.width() < levelSize.width())
+                {
+                    level = i;
+                    levelSize = sz;
+                }
+                if (sz.width() < smallestSize.width())
+                {
+                    smallest = i;
+                    smallestSize = sz;
+                }
+            }
+
+        if (smallest != -1 && smallest != level && bytesFor(smallestSize) <= LargeImageLoader::StripeCap)
+            done(decode(smallest, smallestSize, QSize()), false);
+
+        QImageReader probe(m_path);
+        if (level == -1 && probe.supportsOption(QImageIOHandler::ScaledSize))
+        {
+            //the decoder reduces while decoding (jpeg), a cheap
+            //placeholder first then the real thing
+            done(decode(-1, full, target/4), false);
+            return done(decode(-1, full, target), true);
+        }
+        if (bytesFor(levelSize) <= LargeImageLoader::DecodeCap)
+        {
+            //decoded upright already, a quarter turn swaps the box it goes in
+            const QSize &box = m_transformation & QImageIOHandler::TransformationRotate90 ? target.transposed() : target;
+            return done(decode(level, levelSize, QSize()).scaled(box, Qt::KeepAspectRatio, Qt::SmoothTransformation), true);
+        }
+        if (probe.supportsOption(QImageIOHandler::ClipRect))
+        {
+            const QImage &img = decodeStripes(level, levelSize, target);
+            if (!img.isNull())
+                return done(img, true);
+        }
+        //no way to decode this within the memory cap here, the
+        //thumbnailers of the preview job may still manage
+        decline();
+    }
+
+private:
+    QImage decode(const int index, const QSize &size, const QSize &scaled) const
+    {
+        QImageReader reader(m_path);
+        reader.setAutoTransform(true);
+        if (index > 0)
+            reader.jumpToImage(index);
+        if (scaled.isValid())
+            reader.setScaledSize(size.scaled(scaled, Qt::KeepAspectRatio));
+        return reader.read();
+    }
+    /* QImageReader::setAutoTransform for an image put together by hand,
+     * mirror and flip go first and rotate after, like Qt does it
+     */
+    QImage oriented(const QImage &img) const
+    {
+        QImage o(img);
+        if (m_transformation & (QImageIOHandler::TransformationMirror|QImageIOHandler::TransformationFlip))
+            o = o.mirrored(m_transformation & QImageIOHandler::TransformationMirror, m_transformation & QImageIOHandler::TransformationFlip);
+        if (m_transformation & QImageIOHandler::TransformationRotate90)
+            o = o.transformed(QTransform().rotate(90));
+        return o;
+    }
+    QImage decodeStripes(const int index, const QSize &size, const QSize &target) const
+    {
+        QImage img(target, QImage::Format_ARGB32_Premultiplied);
+        img.fill(Qt::transparent);
+        QPainter p(&img);
+        p.setRenderHint(QPainter::SmoothPixmapTransform);
+        const int stripe = qMax<int>(1, LargeImageLoader::StripeCap/(size.width()*4));
+        //one reader for all stripes, a decoder that can not carry on
+        //where the last stripe ended fails the read rather than
+        //decoding everything above it again
+        QImageReader reader(m_path);
+        if (index > 0)
+            reader.jumpToImage(index);
+        for (int y = 0; y < size.height(); y += stripe)
+        {
+            const int h = qMin(stripe, size.height()-y);
+            reader.setClipRect(QRect(0, y, size.width(), h));
+            const QImage &part = reader.read();
+            if (part.isNull())
+                return QImage();
+            const int top = qint64(y)*target.height()/size.height();
+            const int bottom = qint64(y+h)*target.height()/size.height();
+            if (bottom > top)
+                p.drawImage(QRect(0, top, target.width(), bottom-top), part);
+        }
+        p.end();
+        return oriented(img);
+    }
+    void done(const QImage &img, const bool final)
+    {
+        QMetaObject::invokeMethod(m_loader, "imageReady", Qt::QueuedConnection, Q_ARG(QUrl, m_url), Q_ARG(QImage, img), Q_ARG(bool, final));
+    }
+    void decline()
+    {
+        QMetaObject::invokeMethod(m_loader, "imageDeclined", Qt::QueuedConnection, Q_ARG(QUrl, m_url), Q_ARG(int, m_extent));
+    }
+    LargeImageLoader *m_loader;
+    QUrl m_url;
+    QString m_path;
+    int m_extent;
+    QImageIOHandler::Transformations m_transformation;
+};
+
+LargeImageLoader::LargeImageLoader(QObject *parent)
+    : QObject(parent)
+{
+    //a single thread, a directory full of huge images should
+    //only ever hold up its own previews
+    m_pool.setMaxThreadCount(1);
+}
+
+LargeImageLoader::~LargeImageLoader()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+bool
+LargeImageLoader::handles(const KFileItem &file)
+{
+    return file.isLocalFile() && file.size() >= MinFileSize && file.mimetype().startsWith("image/");
+}
+
+void
+LargeImageLoader::requestPreview(const KFileItem &file, const int extent)
+{
+    const QUrl &url = file.url();
+    if (m_tasks.value(url) && m_extents.value(url) >= extent)
+        return;
+    m_files.insert(url, file);
+    m_extents.insert(url, extent);
+    ++m_tasks[url];
+    m_pool.start(new LargeImageTask(this, url, extent));
+}
+
+void
+LargeImageLoader::imageReady(const QUrl &url, const QImage &img, const bool final)
+{
+    const KFileItem file = m_files.value(url);
+    if (final && !--m_tasks[url])
+    {
+        m_tasks.remove(url);
+        m_extents.remove(url);
+        m_files.remove(url);
+    }
+    if (!img.isNull() && !file.isNull())
+        emit previewLoaded(file, QPixmap::fromImage(img));
+}
+
+void
+LargeImageLoader::imageDeclined(const QUrl &url, const int extent)
+{
+    const KFileItem file = m_files.value(url);
+    if (!--m_tasks[url])
+    {
+        m_tasks.remove(url);
+        m_extents.remove(url);
+        m_files.remove(url);
+    }
+    if (!file.isNull())
+        emit declined(file, extent);
+}
@@ -0,0 +1,77 @@
+/**************************************************************************
+*   Copyright (C) 2013 by Robert Metsaranta                               *
+*   therealestrob@gmail.com                                               *
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program; if not, write to the                         *
+*   Free Software Foundation, Inc.,                                       *
+*   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+***************************************************************************/
+
+
+#ifndef LARGEIMAGES_H
+#define LARGEIMAGES_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <QPixmap>
+#include <QImage>
+#include <QHash>
+#include <QUrl>
+
+#include <KFileItem>
+
+namespace DocSurf
+{
+
+namespace FS
+{
+
+/* Thumbnails for images too big to go through the normal
+ * preview job, where the whole image gets decoded before it
+ * is scaled. These are decoded on their own thread, reduced
+ * while decoding when the format allows it (scaled decode,
+ * a smaller pyramid level or clip rect stripes) and never
+ * beyond DecodeCap bytes. A quick low resolution placeholder
+ * is emitted first when one can be had cheaply. Images that can
+ * not be decoded that way are declined, back to the preview job.
+ */
+class LargeImageLoader : public QObject
+{
+    Q_OBJECT
+public:
+    enum { MinFileSize = 8*1024*1024, DecodeCap = 256*1024*1024, StripeCap = 16*1024*1024 };
+    explicit LargeImageLoader(QObject *parent = 0);
+    ~LargeImageLoader();
+    static bool handles(const KFileItem &file);
+    void requestPreview(const KFileItem &file, const int extent);
+
+signals:
+    void previewLoaded(const KFileItem &file, const QPixmap &pix);
+    void declined(const KFileItem &file, const int extent);
+
+private slots:
+    void imageReady(const QUrl &url, const QImage &img, const bool final);
+    void imageDeclined(const QUrl &url, const int extent);
+
+private:
+    QThreadPool m_pool;
+    QHash<QUrl, KFileItem> m_files;
+    QHash<QUrl, int> m_extents, m_tasks;
+};
+
+}
+
+}
+
+#endif // LARGEIMAGES_H
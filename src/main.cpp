@@ -20,6 +20,7 @@
 
 #include "application.h"
 #include "mainwindow.h"
+#include "iconprovider.h"
 #include <KFileItem>
 
 #include <QDBusMessage>
@@ -52,6 +53,8 @@ int main(int argc, char *argv[])
     }
     else
     {
+        //drawn while the window is being built
+        DocSurf::IconCache::instance()->warmUp();
         DocSurf::MainWindow *mainWin = new DocSurf::MainWindow(app.arguments());
         mainWin->show();
         return app.exec();
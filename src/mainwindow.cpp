@@ -66,6 +66,8 @@
 #include "views/fileplacesview.h"
 #include "viewcontainer.h"
 #include "fsmodel.h"
+#include "cachegovernor.h"
+#include "gfx/effectcache.h"
 #include "searchbox.h"
 #include "tabbar.h"
 #include "mainwindow.h"
@@ -242,6 +244,7 @@ MainWindow::MainWindow(const QStringList &arguments)
     d->terminalDock = 0;
     d->searchBox = 0;
     d->adaptor = new DBusAdaptor(this);
+    CacheGovernor::instance();
 
     QDBusConnection::sessionBus().registerService("com.syndromatic.docsurf");
     QDBusConnection::sessionBus().registerObject("/DocSurfAdaptor", this);
@@ -528,7 +531,7 @@ MainWindow::slotUrlChanged(const QUrl &url)
     }
     else
         t->setTitle(c->title());
-    t->setIcon(QIcon::fromTheme(c->rootItem().iconName()));
+    t->setIcon(IconCache::instance()->themed(c->rootItem().iconName()));
     if (c == activeContainer())
     {
         d->placesView->setUrl(url);
@@ -658,7 +661,7 @@ MainWindow::addTab(const QUrl &url)
         return;
     }
     if (Container *cont = Container::createContainer(url))
-        d->tabManager->addTab(cont, QIcon::fromTheme(cont->mimeType().genericIconName()), cont->title());
+        d->tabManager->addTab(cont, IconCache::instance()->themed(cont->mimeType().genericIconName()), cont->title());
 }
 
 void
@@ -876,4 +879,22 @@ void MainWindow::showAboutInfo()
     about->exec();  // or .show() if it's not modal
 }
 
+QString
+DBusAdaptor::previewStats() const
+{
+    return FS::PreviewLoader::statistics();
+}
+
+QString
+DBusAdaptor::cacheStats() const
+{
+    return CacheGovernor::instance()->statistics();
+}
+
+QString
+DBusAdaptor::effectStats() const
+{
+    return EffectCache::statistics();
+}
+
 #include "mainwindow.moc"
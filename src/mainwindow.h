@@ -122,6 +122,9 @@ public:
 
 public slots:
     Q_NOREPLY void openUrl(const QString &url) { m_win->addTab(QUrl::fromUserInput(url)); }
+    QString previewStats() const;
+    QString cacheStats() const;
+    QString effectStats() const;
 
 //signals:
 
@@ -0,0 +1,95 @@
+/**************************************************************************
+*   Copyright (C) 2013 by Robert Metsaranta                               *
+*   therealestrob@gmail.com                                               *
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program; if not, write to the                         *
+*   Free Software Foundation, Inc.,                                       *
+*   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+***************************************************************************/
+
+
+#include "thumbnails.h"
+
+using namespace DocSurf;
+using namespace FS;
+
+Thumbnail::Thumbnail()
+    : m_top(-1)
+{
+}
+
+Thumbnail::Thumbnail(const QPixmap &source)
+    : m_top(-1)
+{
+    if (source.isNull())
+        return;
+
+    const int extent(qMax(source.width(), source.height()));
+    m_top = levelForExtent(extent);
+    if (extent > extentForLevel(m_top))
+        m_levels[m_top] = source.scaled(extentForLevel(m_top), extentForLevel(m_top), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    else
+        m_levels[m_top] = source;
+    m_icon.addPixmap(m_levels[m_top]);
+
+    //each level is built from the one above it so we only
+    //ever halve, that keeps the smooth scaling cheap and sharp
+    for (int i = m_top-1; i >= 0; --i)
+    {
+        const QPixmap &above(m_levels[i+1]);
+        const int e(extentForLevel(i));
+        if (qMax(above.width(), above.height()) <= e)
+            m_levels[i] = above;
+        else
+            m_levels[i] = above.scaled(e, e, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        m_icon.addPixmap(m_levels[i]);
+    }
+}
+
+int
+Thumbnail::levelForExtent(const int extent)
+{
+    int level(0);
+    while (level < Levels-1 && extentForLevel(level) < extent)
+        ++level;
+    return level;
+}
+
+QPixmap
+Thumbnail::level(const int level) const
+{
+    if (m_top == -1)
+        return QPixmap();
+    return m_levels[qBound(0, level, m_top)];
+}
+
+QPixmap
+Thumbnail::pixmap(const int extent) const
+{
+    return level(levelForExtent(extent));
+}
+
+qint64
+Thumbnail::byteCount() const
+{
+    qint64 bytes(0);
+    for (int i = 0; i <= m_top; ++i)
+    {
+        const QPixmap &p(m_levels[i]);
+        if (i < m_top && p.cacheKey() == m_levels[i+1].cacheKey())
+            continue;
+        bytes += qint64(p.width())*p.height()*(p.depth()/8);
+    }
+    return bytes;
+}
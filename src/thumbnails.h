@@ -0,0 +1,67 @@
+/**************************************************************************
+*   Copyright (C) 2013 by Robert Metsaranta                               *
+*   therealestrob@gmail.com                                               *
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program; if not, write to the                         *
+*   Free Software Foundation, Inc.,                                       *
+*   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+***************************************************************************/
+
+
+#ifndef THUMBNAILS_H
+#define THUMBNAILS_H
+
+#include <QPixmap>
+#include <QIcon>
+
+namespace DocSurf
+{
+
+namespace FS
+{
+
+/* A preview stored as a small mip chain, 32/64/128/256 px,
+ * each level half the size of the one above it. Views ask
+ * for the level covering their icon size instead of scaling
+ * a 256 px preview down on every paint. Levels above the
+ * one that was actually requested are never loaded.
+ */
+class Thumbnail
+{
+public:
+    enum { Levels = 4, MinExtent = 32, MaxExtent = MinExtent << (Levels-1) };
+    Thumbnail();
+    explicit Thumbnail(const QPixmap &source);
+
+    inline bool isNull() const { return m_top == -1; }
+    inline int topLevel() const { return m_top; }
+    inline QIcon icon() const { return m_icon; }
+    QPixmap level(const int level) const;
+    QPixmap pixmap(const int extent) const;
+    qint64 byteCount() const;
+
+    static int levelForExtent(const int extent);
+    static inline int extentForLevel(const int level) { return MinExtent << level; }
+
+private:
+    QPixmap m_levels[Levels];
+    QIcon m_icon;
+    int m_top;
+};
+
+}
+
+}
+
+#endif // THUMBNAILS_H
@@ -28,7 +28,7 @@ using namespace DocSurf;
 
 QMap<QAbstractItemView *, ViewAnimator *> ViewAnimator::s_views;
 
-ViewAnimator::ViewAnimator(QObject *parent) : QObject(parent),
+ViewAnimator::ViewAnimator(QObject *parent) : QObject(parent), Cacheable(Rebuildable),
     m_timer(new QTimer(this)),
     m_view(static_cast<QAbstractItemView *>(parent))
 {
@@ -57,6 +57,18 @@ ViewAnimator::indexHovered(const QModelIndex &index)
     }
 }
 
+void
+ViewAnimator::shrinkCache(const qint64 bytes)
+{
+    Q_UNUSED(bytes);
+    //fades just end where they are, only the hovered index is kept
+    const int current = m_vals.value(m_current, -1);
+    m_vals.clear();
+    if (current != -1)
+        m_vals.insert(m_current, current);
+    m_view->viewport()->update();
+}
+
 void
 ViewAnimator::rowsRemoved(const QModelIndex &parent, int start, int end)
 {
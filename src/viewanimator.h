@@ -26,15 +26,19 @@
 #include <QAbstractItemModel>
 #include <QTimer>
 #include <QEvent>
+#include "cachegovernor.h"
 namespace DocSurf
 {
-class ViewAnimator : public QObject
+class ViewAnimator : public QObject, public Cacheable
 {
     Q_OBJECT
 public:
     enum { Steps = 16 };
     static ViewAnimator *manage(QAbstractItemView *view);
     static int hoverLevel(QAbstractItemView *view, const QModelIndex &index);
+    QString cacheName() const { return "hover animations"; }
+    qint64 cacheCost() const { return m_vals.count()*(sizeof(QModelIndex)+sizeof(int)+32); }
+    void shrinkCache(const qint64 bytes);
 
 protected:
     bool eventFilter(QObject *obj, QEvent *ev);
@@ -418,6 +418,7 @@ ViewContainer::viewAction(const View view)
 
 void ViewContainer::setIconSize(int stop)
 {
+    d->model->setThumbnailExtent(stop*devicePixelRatioF());
     for (int i = 0; i < NViews; ++i)
     {
         d->view[i]->setIconSize(QSize(stop, stop));
@@ -35,6 +35,7 @@
 #include "columnview.h"
 #include "viewcontainer.h"
 #include "objects.h"
+#include "imagepreparer.h"
 
 #include <fsmodel.h>
 
@@ -63,14 +64,31 @@ public:
 
         //icon
         QStyle *style = QApplication::style();
-        const QIcon icon = index.data(Qt::DecorationRole).value<QIcon>();
-        QPixmap pix = icon.pixmap(view->iconSize().width());
-        if (pix.height() > view->iconSize().height() || pix.width() > view->iconSize().width())
-            pix = pix.scaled(view->iconSize(), Qt::KeepAspectRatio, Qt::SmoothTransformation);
-        const QRect ir = style->itemPixmapRect(QRect(option.rect.topLeft(), QSize(view->iconSize().width()+4, option.rect.height())), Qt::AlignCenter, pix);
-
-        if (!pix.isNull())
-            style->drawItemPixmap(painter, ir, Qt::AlignCenter, pix);
+        const QRect iconArea(option.rect.topLeft(), QSize(view->iconSize().width()+4, option.rect.height()));
+        const qreal dpr = painter->device()->devicePixelRatioF();
+        const FS::ProxyModel *model = qobject_cast<const FS::ProxyModel *>(index.model());
+        const FS::Thumbnail thumb = model ? model->thumbnail(index, view->iconSize().width()*dpr) : FS::Thumbnail();
+        QRect ir;
+        if (!thumb.isNull())
+        {
+            //nearest mip level, only ever drawn down to the icon size
+            const QPixmap pix = thumb.pixmap(view->iconSize().width()*dpr);
+            QSize sz(pix.size()/dpr);
+            if (sz.width() > view->iconSize().width() || sz.height() > view->iconSize().height())
+                sz.scale(view->iconSize(), Qt::KeepAspectRatio);
+            ir = QRect(QPoint(), sz);
+            ir.moveCenter(iconArea.center());
+            const QPixmap ready = ImagePreparer::instance()->prepared(model->urlForIndex(index), pix, sz*dpr);
+            painter->drawPixmap(ir, ready.isNull() ? pix : ready);
+        }
+        else
+        {
+            const QPixmap pix = model ? model->iconPixmap(index, view->iconSize())
+                                      : index.data(Qt::DecorationRole).value<QIcon>().pixmap(view->iconSize().width());
+            ir = style->itemPixmapRect(iconArea, Qt::AlignCenter, pix);
+            if (!pix.isNull())
+                style->drawItemPixmap(painter, ir, Qt::AlignCenter, pix);
+        }
 
         //thumbnail shadow
 //        if (index.data(FS::FileHasThumbRole).toBool())
@@ -51,6 +51,8 @@
 #include "viewanimator.h"
 #include "objects.h"
 #include "fsmodel.h"
+#include "imagepreparer.h"
+#include "cachegovernor.h"
 
 using namespace DocSurf;
 
@@ -77,14 +79,24 @@ using namespace DocSurf;
 //    }
 //};
 
-class IconDelegate : public FileItemDelegate
+class IconDelegate : public FileItemDelegate, public Cacheable
 {
 public:
     inline explicit IconDelegate(IconView *parent)
         : FileItemDelegate(parent)
+        , Cacheable(Rebuildable)
         , m_iv(parent)
     {
     }
+    QString cacheName() const { return "icon text layouts"; }
+    qint64 cacheCost() const
+    {
+        qint64 cost(0);
+        for (QHash<QModelIndex, QString>::const_iterator it = m_textData.constBegin(), end = m_textData.constEnd(); it != end; ++it)
+            cost += it.value().size()*sizeof(QChar) + sizeof(QModelIndex) + 32;
+        return cost;
+    }
+    void shrinkCache(const qint64 bytes) { Q_UNUSED(bytes); clearData(); }
     void setEditorData(QWidget *editor, const QModelIndex &index) const
     {
         FileItemDelegate::setEditorData(editor, index);
@@ -133,24 +145,31 @@ public:
         const bool enabled = option.state & QStyle::State_Enabled;
         QApplication::style()->drawItemText(painter, textRect, Qt::AlignTop|Qt::AlignHCenter, option.palette, enabled, text(option, index), textRole);
 
-        QPixmap pixmap = option.icon.pixmap(m_iv->iconSize());
-        if (pixmap.isNull())
-            pixmap = index.data(Qt::DecorationRole).value<QIcon>().pixmap(m_iv->iconSize());
-
-        QSize sz = pixmap.size();
-        if (pixmap.size() != m_iv->iconSize()) //probably a thumb...
+        const FS::ProxyModel *model = qobject_cast<const FS::ProxyModel *>(index.model());
+        const int extent = qMax(pixRect.width(), pixRect.height())*painter->device()->devicePixelRatioF();
+        const FS::Thumbnail thumb = model ? model->thumbnail(index, extent) : FS::Thumbnail();
+        if (!thumb.isNull())
         {
-            const qreal widthFactor = (qreal)pixRect.width()/(qreal)pixmap.width();
-            const qreal heightFactor = (qreal)pixRect.height()/(qreal)pixmap.height();
-            const qreal factor = qMax(widthFactor, heightFactor);
-            sz = sz.scaled(sz.width()*factor, sz.height()*factor, Qt::KeepAspectRatio).boundedTo(pixRect.size());
-            pixmap = option.icon.pixmap(sz);
+            //pick the mip level covering the rect and blit the copy prepared
+            //for the exact target size, the unscaled level is only drawn
+            //until the preparer has it ready
+            const qreal dpr = painter->device()->devicePixelRatioF();
+            const QPixmap pixmap = thumb.pixmap(extent);
+            QRect r(QPoint(), pixmap.size().scaled(pixRect.size(), Qt::KeepAspectRatio));
+            r.moveCenter(pixRect.center());
+            const QPixmap ready = ImagePreparer::instance()->prepared(model->urlForIndex(index), pixmap, r.size()*dpr);
+            painter->drawPixmap(r, ready.isNull() ? pixmap : ready);
+        }
+        else
+        {
+            QPixmap pixmap = model ? model->iconPixmap(index, m_iv->iconSize()) : QPixmap();
+            if (pixmap.isNull())
+                pixmap = option.icon.pixmap(m_iv->iconSize());
             if (pixmap.isNull())
-                pixmap = index.data(Qt::DecorationRole).value<QIcon>().pixmap(sz);
+                pixmap = index.data(Qt::DecorationRole).value<QIcon>().pixmap(m_iv->iconSize());
+            pixRect = QApplication::style()->itemPixmapRect(pixRect, Qt::AlignCenter, pixmap);
+            QApplication::style()->drawItemPixmap(painter, pixRect, Qt::AlignCenter, pixmap);
         }
-
-        pixRect = QApplication::style()->itemPixmapRect(pixRect, Qt::AlignCenter, pixmap);
-        QApplication::style()->drawItemPixmap(painter, pixRect, Qt::AlignCenter, pixmap);
         painter->setPen(savedPen);
         painter->setBrush(savedBrush);
     }
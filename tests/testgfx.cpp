@@ -0,0 +1,242 @@
+#include "fx.h"
+#include "warp.h"
+#include "color.h"
+#include "cpu.h"
+#include <QCoreApplication>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QCryptographicHash>
+#include <QTransform>
+#include <QImage>
+#include <QColor>
+#include <QHash>
+#include <QStringList>
+#include <cstdio>
+
+/*
+// docsurf-test-gfx ================================================
+*  FX::blend against Color::mid, the per pixel code it replaced, over
+*  random straight argb pixels and weights. ctest runs it with
+*  DOCSURF_SIMD=scalar, =sse2 and =avx2, the line kernels then have to
+*  agree with Color::mid and so with each other, byte for byte.
+*  FX::stretched gets the images it has nothing to stretch in.
+*  The kernels without a per pixel reference of their own are run
+*  once more in a child started with DOCSURF_SIMD=scalar, and what
+*  every one of them made has to match what the SIMD run made.
+*/
+
+static quint32 seed(0x9e3779b9);
+static quint32
+lcg()
+{
+    seed = seed*1664525u + 1013904223u;
+    return seed;
+}
+
+/* every alpha, the extremes included, and odd widths for the tails */
+static QImage
+noise(const int w, const int h)
+{
+    QImage img(w, h, QImage::Format_ARGB32);
+    for (int y = 0; y < h; ++y)
+    {
+        QRgb *px = reinterpret_cast<QRgb *>(img.scanLine(y));
+        for (int x = 0; x < w; ++x)
+        {
+            px[x] = lcg();
+            if (!(x % 7))
+                px[x] |= 0xff000000;
+            else if (!(x % 11))
+                px[x] &= 0x00ffffff;
+        }
+    }
+    return img;
+}
+
+static int
+check(const int a1, const int a2)
+{
+    const int w = 1 + lcg() % 67, h = 1 + lcg() % 9;
+    const QImage i1 = noise(w, h), i2 = noise(w, h);
+    QImage img(i1);
+    FX::blend(img, i2, a1, a2);
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+        {
+            const QRgb want = Color::mid(QColor::fromRgba(i1.pixel(x, y)), QColor::fromRgba(i2.pixel(x, y)), a1, a2).rgba();
+            const QRgb got = img.pixel(x, y);
+            if (got != want)
+            {
+                fprintf(stderr, "weights %d:%d at %d,%d: %08x and %08x gave %08x, Color::mid %08x\n",
+                        a1, a2, x, y, i1.pixel(x, y), i2.pixel(x, y), got, want);
+                return 1;
+            }
+        }
+    return 0;
+}
+
+/* FX::stretched on images with nothing to stretch: fully transparent,
+ * one flat color, and one gray in the alpha branch. They must come out
+ * the same for every pixel, and transparent stays transparent.
+ */
+static int
+checkStretched()
+{
+    const QColor fg(32, 64, 96);
+    struct Case { QRgb px; const char *name; };
+    static const Case cases[] = { { 0x00000000, "transparent" }, { 0xff336699, "flat" }, { 0xff000000, "black" }, { 0xffffffff, "white" } };
+    int failed(0);
+    for (unsigned int c = 0; c < sizeof(cases)/sizeof(cases[0]); ++c)
+    {
+        QImage img(23, 17, QImage::Format_ARGB32);
+        img.fill(cases[c].px);
+        const QImage &out = FX::stretched(img, fg).convertToFormat(QImage::Format_ARGB32);
+        const QRgb first = out.pixel(0, 0);
+        bool uniform(true);
+        for (int y = 0; y < out.height(); ++y)
+            for (int x = 0; x < out.width(); ++x)
+                uniform &= out.pixel(x, y) == first;
+        if (!uniform || (!qAlpha(cases[c].px) && qAlpha(first)))
+        {
+            fprintf(stderr, "FX::stretched on %s gave %08x at 0,0, %s\n", cases[c].name, first, uniform ? "not transparent" : "not uniform");
+            ++failed;
+        }
+    }
+    return failed;
+}
+
+static QByteArray
+md5(const QImage &img)
+{
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    for (int y = 0; y < img.height(); ++y)
+        hash.addData(reinterpret_cast<const char *>(img.constScanLine(y)), img.width()*4);
+    return hash.result().toHex();
+}
+
+/* what each kernel makes of the same noise, as a digest per case,
+ * odd sizes so every tail and strip remainder is in there
+ */
+static QHash<QString, QByteArray>
+digests()
+{
+    seed = 0x2545f491;
+    QHash<QString, QByteArray> d;
+    const QList<QSize> sizes = QList<QSize>() << QSize(3, 2) << QSize(67, 45) << QSize(301, 129);
+    for (int s = 0; s < sizes.count(); ++s)
+    {
+        const QSize size = sizes.at(s);
+        const QString tag = QString("%1x%2").arg(size.width()).arg(size.height());
+        const QImage source = noise(size.width(), size.height()), other = noise(size.width(), size.height());
+        const QImage premultiplied = source.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        QImage img;
+
+        const int radii[] = { 1, 3, 8, 20, 64 };
+        for (unsigned int r = 0; r < sizeof(radii)/sizeof(radii[0]); ++r)
+        {
+            img = premultiplied;
+            FX::expblur(img, radii[r]);
+            d.insert(QString("expblur r%1 %2").arg(radii[r]).arg(tag), md5(img));
+            img = premultiplied;
+            FX::expblur(img, radii[r], Qt::Vertical);
+            d.insert(QString("expblur vertical r%1 %2").arg(radii[r]).arg(tag), md5(img));
+            img = premultiplied;
+            FX::boxblur(img, radii[r]);
+            d.insert(QString("boxblur r%1 %2").arg(radii[r]).arg(tag), md5(img));
+            img = premultiplied;
+            FX::boxblur(img, radii[r], Qt::Horizontal);
+            d.insert(QString("boxblur horizontal r%1 %2").arg(radii[r]).arg(tag), md5(img));
+        }
+
+        img = source;
+        int lo(0), hi(0);
+        FX::grayscale(img, &lo, &hi);
+        d.insert(QString("grayscale %1").arg(tag), md5(img) + QByteArray::number(lo) + '-' + QByteArray::number(hi));
+        FX::levels(img, lo, hi);
+        d.insert(QString("levels %1").arg(tag), md5(img));
+        img = source;
+        FX::levels(img, 200, 40, 10, 250);
+        d.insert(QString("levels inverted %1").arg(tag), md5(img));
+
+        d.insert(QString("mid %1").arg(tag), md5(FX::mid(source, other, 1, 1)));
+        d.insert(QString("mid 2:3 %1").arg(tag), md5(FX::mid(source, other, 2, 3)));
+
+        QTransform cover;
+        cover.translate(size.width()/2.0, size.height()/2.0).rotate(50.0, Qt::YAxis).translate(-size.width()/2.0, -size.height()/2.0);
+        img = other.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        FX::warp(img, premultiplied, cover);
+        d.insert(QString("warp %1").arg(tag), md5(img));
+    }
+    return d;
+}
+
+/* the digests of this run against the ones of a scalar child */
+static int
+checkAgainstScalar(const QHash<QString, QByteArray> &mine)
+{
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert("DOCSURF_SIMD", "scalar");
+    QProcess child;
+    child.setProcessEnvironment(env);
+    child.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    child.start(QCoreApplication::applicationFilePath(), QStringList() << "--digests");
+    if (!child.waitForFinished(-1) || child.exitCode())
+    {
+        fprintf(stderr, "scalar run failed\n");
+        return 1;
+    }
+    QHash<QString, QByteArray> scalar;
+    const QList<QByteArray> lines = child.readAllStandardOutput().split('\n');
+    for (int i = 0; i < lines.count(); ++i)
+    {
+        const int tab = lines.at(i).indexOf('\t');
+        if (tab > 0)
+            scalar.insert(QString::fromLatin1(lines.at(i).left(tab)), lines.at(i).mid(tab+1));
+    }
+    int failed(0);
+    for (QHash<QString, QByteArray>::const_iterator it = mine.constBegin(), end = mine.constEnd(); it != end; ++it)
+        if (scalar.value(it.key()) != it.value())
+        {
+            fprintf(stderr, "%s differs from the scalar run\n", qPrintable(it.key()));
+            ++failed;
+        }
+    return failed;
+}
+
+int
+main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    if (app.arguments().contains("--digests"))
+    {
+        const QHash<QString, QByteArray> d = digests();
+        for (QHash<QString, QByteArray>::const_iterator it = d.constBegin(), end = d.constEnd(); it != end; ++it)
+            printf("%s\t%s\n", qPrintable(it.key()), it.value().constData());
+        return 0;
+    }
+
+    const char *level = CPU::level() == CPU::Scalar ? "scalar" : CPU::level() == CPU::SSE2 ? "sse2" : "avx2";
+    int failed(0);
+    //equal weights take the byte average, the rest the 16 bit sums,
+    //past 257 in total the scalar kernel does it all
+    static const int weights[][2] = { { 1, 1 }, { 3, 3 }, { 1, 2 }, { 2, 1 }, { 1, 3 }, { 0, 1 }, { 1, 0 }, { 7, 250 }, { 128, 129 }, { 200, 100 } };
+    for (unsigned int i = 0; i < sizeof(weights)/sizeof(weights[0]); ++i)
+        for (int run = 0; run < 64; ++run)
+            failed += check(weights[i][0], weights[i][1]);
+    for (int run = 0; run < 4096; ++run)
+    {
+        const int a1 = lcg() % 200, a2 = 1 + lcg() % 200;
+        failed += check(a1, a2);
+    }
+    fprintf(stderr, "FX::blend (%s): %d mismatching runs\n", level, failed);
+    const int stretched = checkStretched();
+    fprintf(stderr, "FX::stretched (%s): %d failing cases\n", level, stretched);
+    //the scalar run is the reference, it has nothing to compare to
+    int kernels(0);
+    if (CPU::level() > CPU::Scalar)
+    {
+        kernels = checkAgainstScalar(digests());
+        fprintf(stderr, "kernels (%s against scalar): %d differing cases\n", level, kernels);
+    }
+    return failed || stretched || kernels ? 1 : 0;
+}